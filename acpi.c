@@ -0,0 +1,168 @@
+#include "acpi.h"
+#include "console.h"
+
+// acpiChecksum: sum of bytes must be 0
+int acpiChecksum(void *addr, int len)
+{
+    uint8_t sum = 0;
+    uint8_t *p = (uint8_t *)addr;
+    for(int i = 0; i < len; i++)
+    {
+        sum += p[i];
+    }
+    return sum;
+}
+
+// acpiSigEqual: compare n bytes of signature
+int acpiSigEqual(const char *a, const char *b, int n)
+{
+    for(int i = 0; i < n; i++)
+    {
+        if(a[i] != b[i])
+        {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// rsdpSearch: search RSDP in [start, start + len), it
+//             lies on 16 bytes boundary
+struct rsdp *rsdpSearch(uint32_t start, uint32_t len)
+{
+    for(uint32_t p = start; p < start + len; p += 16)
+    {
+        struct rsdp *r = (struct rsdp *)p;
+        if(acpiSigEqual(r->signature, RSDP_SIG, 8) &&
+           acpiChecksum(r, sizeof(struct rsdp)) == 0)
+        {
+            return r;
+        }
+    }
+    return NULL;
+}
+
+// rsdpFind: RSDP is in the first 1KB of EBDA, or in
+//           BIOS ROM between 0xe0000 and 0xfffff
+struct rsdp *rsdpFind()
+{
+    struct rsdp *r;
+    uint32_t ebda = (*(uint16_t *)0x40e) << 4;
+    if(ebda != 0 && (r = rsdpSearch(ebda, 1024)) != NULL)
+    {
+        return r;
+    }
+    return rsdpSearch(0xe0000, 0x20000);
+}
+
+void madtParse(struct madt *m)
+{
+    acpi.lapicAddr = m->lapicAddr;
+
+    uint8_t *p = m->entries;
+    uint8_t *end = (uint8_t *)m + m->hdr.length;
+    while(p < end)
+    {
+        struct madtEntry *e = (struct madtEntry *)p;
+        if(e->length == 0)
+        {
+            break;
+        }
+
+        switch(e->type)
+        {
+        case MADT_LAPIC:
+        {
+            struct madtLapic *l = (struct madtLapic *)e;
+            if((l->flags & MADT_LAPIC_ENABLED) && acpi.ncpu < NCPU)
+            {
+                acpi.apicIds[acpi.ncpu++] = l->apicId;
+            }
+            break;
+        }
+        case MADT_IOAPIC:
+        {
+            // only the first I/O APIC, it serves ISA irqs
+            struct madtIoapic *io = (struct madtIoapic *)e;
+            if(acpi.ioapicAddr == 0)
+            {
+                acpi.ioapicAddr = io->addr;
+                acpi.ioapicId = io->ioapicId;
+                acpi.ioapicGsiBase = io->gsiBase;
+            }
+            break;
+        }
+        case MADT_ISO:
+        {
+            struct madtIso *iso = (struct madtIso *)e;
+            if(iso->bus == 0 && iso->source < 16)
+            {
+                acpi.isaGsi[iso->source] = iso->gsi;
+                acpi.isaFlags[iso->source] = iso->flags;
+            }
+            break;
+        }
+        case MADT_LAPIC_ADDR:
+        {
+            struct madtLapicAddr *la = (struct madtLapicAddr *)e;
+            acpi.lapicAddr = (uint32_t)la->addr;
+            break;
+        }
+        default:
+            break;
+        }
+
+        p += e->length;
+    }
+}
+
+int acpiInit()
+{
+    // ISA irqs are identity mapped unless overridden
+    acpi.ncpu = 0;
+    acpi.lapicAddr = 0;
+    acpi.ioapicAddr = 0;
+    for(int i = 0; i < 16; i++)
+    {
+        acpi.isaGsi[i] = i;
+        acpi.isaFlags[i] = 0;
+    }
+
+    struct rsdp *r = rsdpFind();
+    if(r == NULL)
+    {
+        printf("[acpi] RSDP not found\n");
+        return -1;
+    }
+
+    struct sdtHeader *rsdt = (struct sdtHeader *)r->rsdtAddr;
+    if(!acpiSigEqual(rsdt->signature, "RSDT", 4) ||
+       acpiChecksum(rsdt, rsdt->length) != 0)
+    {
+        printf("[acpi] bad RSDT\n");
+        return -1;
+    }
+
+    int n = (rsdt->length - sizeof(struct sdtHeader)) / 4;
+    uint32_t *tables = (uint32_t *)(rsdt + 1);
+    for(int i = 0; i < n; i++)
+    {
+        struct sdtHeader *h = (struct sdtHeader *)tables[i];
+        if(acpiSigEqual(h->signature, MADT_SIG, 4) &&
+           acpiChecksum(h, h->length) == 0)
+        {
+            madtParse((struct madt *)h);
+            break;
+        }
+    }
+
+    if(acpi.lapicAddr == 0 || acpi.ioapicAddr == 0 || acpi.ncpu == 0)
+    {
+        printf("[acpi] no APIC in MADT\n");
+        return -1;
+    }
+
+    printf("[acpi] %d cpus, lapic %x, ioapic %x\n", acpi.ncpu,
+           acpi.lapicAddr, acpi.ioapicAddr);
+    return 0;
+}
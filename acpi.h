@@ -0,0 +1,116 @@
+#ifndef _ACPI_H
+#define _ACPI_H
+
+#include "types.h"
+#include "cpu.h"
+
+// ACPI tables, only what is needed to find interrupt
+// controllers and processors: RSDP -> RSDT -> MADT
+
+#define RSDP_SIG "RSD PTR "
+#define MADT_SIG "APIC"
+
+// MADT entry types
+#define MADT_LAPIC       0 // processor local APIC
+#define MADT_IOAPIC      1 // I/O APIC
+#define MADT_ISO         2 // interrupt source override
+#define MADT_LAPIC_ADDR  5 // 64 bits local APIC address override
+
+#define MADT_LAPIC_ENABLED 0x1
+
+// MPS INTI flags in interrupt source override
+#define MADT_POLARITY_MASK 0x3
+#define MADT_POLARITY_LOW  0x3
+#define MADT_TRIGGER_MASK  0xc
+#define MADT_TRIGGER_LEVEL 0xc
+
+struct rsdp
+{
+    char signature[8];
+    uint8_t checksum;
+    char oemid[6];
+    uint8_t revision;
+    uint32_t rsdtAddr;
+}__attribute__((packed));
+
+struct sdtHeader
+{
+    char signature[4];
+    uint32_t length;
+    uint8_t revision;
+    uint8_t checksum;
+    char oemid[6];
+    char oemTableId[8];
+    uint32_t oemRevision;
+    uint32_t creatorId;
+    uint32_t creatorRevision;
+}__attribute__((packed));
+
+struct madt
+{
+    struct sdtHeader hdr;
+    uint32_t lapicAddr;
+    uint32_t flags;
+    uint8_t entries[0];
+}__attribute__((packed));
+
+struct madtEntry
+{
+    uint8_t type;
+    uint8_t length;
+}__attribute__((packed));
+
+struct madtLapic
+{
+    struct madtEntry e;
+    uint8_t acpiId;
+    uint8_t apicId;
+    uint32_t flags;
+}__attribute__((packed));
+
+struct madtIoapic
+{
+    struct madtEntry e;
+    uint8_t ioapicId;
+    uint8_t reserved;
+    uint32_t addr;
+    uint32_t gsiBase;
+}__attribute__((packed));
+
+struct madtIso
+{
+    struct madtEntry e;
+    uint8_t bus;
+    uint8_t source; // ISA irq
+    uint32_t gsi;   // global system interrupt it connects to
+    uint16_t flags;
+}__attribute__((packed));
+
+struct madtLapicAddr
+{
+    struct madtEntry e;
+    uint16_t reserved;
+    uint64_t addr;
+}__attribute__((packed));
+
+// what we learn from MADT
+struct acpiInfo
+{
+    uint32_t lapicAddr;        // local APIC physical address
+    uint32_t ioapicAddr;       // first I/O APIC physical address
+    uint8_t ioapicId;
+    uint32_t ioapicGsiBase;
+    int ncpu;                  // enabled processors
+    uint8_t apicIds[NCPU];     // their local APIC ids
+    uint32_t isaGsi[16];       // ISA irq to global system interrupt
+    uint16_t isaFlags[16];     // polarity and trigger mode
+};
+
+struct acpiInfo acpi;
+
+// acpiInit: find RSDP and parse MADT into acpi
+// parameters: void
+// outputs   : 0-success, -1-no ACPI or no MADT
+int acpiInit();
+
+#endif // _ACPI_H
@@ -0,0 +1,428 @@
+#include "ahci.h"
+#include "pci.h"
+#include "memory.h"
+#include "console.h"
+#include "softirq.h"
+#include "thread.h"
+
+int ahciInit()
+{
+    nahciPort = 0;
+    struct pciDev *d = pciFindClass(PCI_CLASS_STORAGE, PCI_SUB_SATA, 0);
+    // prog if 1: AHCI, ABAR is memory BAR5
+    if(d == NULL || d->progif != 0x01 || (d->bar[5] & PCI_BAR_IO))
+    {
+        printf("[ahci] no AHCI controller\n");
+        return -1;
+    }
+
+    pciEnable(d);
+    ahciHba = (struct hbaMem *)(d->bar[5] & ~0xf);
+    ahciHba->ghc |= HBA_GHC_AE;
+    ringInit(&ahciDone, ahciDoneSlots, AHCI_NDONE, RING_SP_ENQ | RING_SC_DEQ);
+
+    // ports with a SATA disk linked up
+    uint32_t pi = ahciHba->pi;
+    for(int i = 0; i < 32 && nahciPort < AHCI_NPORT; i++)
+    {
+        struct hbaPort *p = &(ahciHba->ports[i]);
+        if(!(pi & ((uint32_t)1 << i)) || PX_SSTS_DET(p->ssts) != 3 ||
+           PX_SSTS_IPM(p->ssts) != 1 || p->sig != PX_SIG_ATA)
+        {
+            continue;
+        }
+
+        struct ahciPort *ap = &(ahciPorts[nahciPort]);
+        ap->device = AHCI_DEV_BASE + nahciPort;
+        ap->port = i;
+        ap->regs = p;
+        if(ahciPortInit(ap) == 0)
+        {
+            nahciPort++;
+        }
+    }
+
+    // legacy INTx on the line set up by firmware
+    ahciIrq = d->irq;
+    if(ahciIrq >= 16)
+    {
+        printf("[ahci] no interrupt line\n");
+        return -1;
+    }
+    bhRegister(MASTER_BOUND + ahciIrq, ahciBottomHalf);
+    registerIrqHandler(MASTER_BOUND + ahciIrq, ahciInterruptHandler, NULL);
+    irqEnable(ahciIrq);
+    ahciHba->is = 0xffffffff;
+    ahciHba->ghc |= HBA_GHC_IE;
+
+    return nahciPort;
+}
+
+void ahciPortStop(struct hbaPort *p)
+{
+    p->cmd &= ~PX_CMD_ST;
+    while(p->cmd & PX_CMD_CR)
+    {
+        cpuRelax();
+    }
+    p->cmd &= ~PX_CMD_FRE;
+    while(p->cmd & PX_CMD_FR)
+    {
+        cpuRelax();
+    }
+}
+
+void ahciPortStart(struct hbaPort *p)
+{
+    p->serr = 0xffffffff;
+    p->is = 0xffffffff;
+    p->cmd |= PX_CMD_FRE;
+    p->cmd |= PX_CMD_ST;
+}
+
+// ahciFis: fill H2D register FIS of a command table
+void ahciFis(struct hbaCmdTable *t, int cmd, sector_t lba, int count, int feature)
+{
+    uint8_t *f = t->cfis;
+    memset(f, 0, 20);
+    f[0] = FIS_TYPE_H2D;
+    f[1] = FIS_H2D_CMD;
+    f[2] = cmd;
+    f[3] = feature & 0xff;
+    f[4] = lba & 0xff;
+    f[5] = (lba >> 8) & 0xff;
+    f[6] = (lba >> 16) & 0xff;
+    f[7] = ATA_DEV_LBA;
+    f[8] = (lba >> 24) & 0xff;
+    f[9] = (lba >> 32) & 0xff;
+    f[10] = (lba >> 40) & 0xff;
+    f[11] = (feature >> 8) & 0xff;
+    f[12] = count & 0xff;
+    f[13] = (count >> 8) & 0xff;
+}
+
+// ahciPrdBuild: append PRDs covering buf, split at pages
+int ahciPrdBuild(struct hbaCmdTable *t, int n, void *buf, uint32_t len)
+{
+    uint32_t pa = (uint32_t)buf;
+    while(len > 0 && n < AHCI_NPRD)
+    {
+        uint32_t chunk = PGUPBOUND(pa + 1) - pa;
+        if(chunk > len)
+        {
+            chunk = len;
+        }
+        t->prdt[n].dba = pa;
+        t->prdt[n].dbau = 0;
+        t->prdt[n].rsv = 0;
+        t->prdt[n].dbc = chunk - 1;
+        n++;
+        pa += chunk;
+        len -= chunk;
+    }
+    return n;
+}
+
+// ahciPoll: non-data or data-in command in slot 0, polled. the
+//           port has nothing else issued
+int ahciPoll(struct ahciPort *ap, uint8_t cmd, void *buf, uint32_t len)
+{
+    struct hbaPort *p = ap->regs;
+    struct hbaCmdTable *t = ap->ctab[0];
+    ahciFis(t, cmd, 0, 0, 0);
+    t->cfis[7] = 0;
+    int n = (len > 0) ? ahciPrdBuild(t, 0, buf, len) : 0;
+    ap->clist[0].flags = 5; // FIS is 5 dwords
+    ap->clist[0].prdtl = n;
+    ap->clist[0].prdbc = 0;
+
+    while(p->tfd & (PX_TFD_BSY | PX_TFD_DRQ))
+    {
+        cpuRelax();
+    }
+    p->ci = 1;
+    while(p->ci & 1)
+    {
+        if(p->is & PX_IS_TFES)
+        {
+            return -1;
+        }
+        cpuRelax();
+    }
+    return (p->tfd & PX_TFD_ERR) ? -1 : 0;
+}
+
+int ahciPortInit(struct ahciPort *ap)
+{
+    struct hbaPort *p = ap->regs;
+
+    // 1. stop the port before moving its memory
+    ahciPortStop(p);
+
+    // 2. command list (1KB) and received FIS (256B) share a
+    //    page, a command table takes a page for each slot
+    char *pg = allocPage();
+    memset(pg, 0, PGSIZE);
+    ap->clist = (struct hbaCmdHeader *)pg;
+    p->clb = (uint32_t)pg;
+    p->clbu = 0;
+    p->fb = (uint32_t)(pg + 1024);
+    p->fbu = 0;
+
+    ap->nslot = HBA_CAP_NCS(ahciHba->cap);
+    for(int i = 0; i < ap->nslot; i++)
+    {
+        ap->ctab[i] = (struct hbaCmdTable *)allocPage();
+        memset(ap->ctab[i], 0, PGSIZE);
+        ap->clist[i].ctba = (uint32_t)ap->ctab[i];
+        ap->clist[i].ctbau = 0;
+        ap->slotRq[i] = NULL;
+    }
+    ap->issued = 0;
+
+    // 3. start and ask the disk who it is
+    ahciPortStart(p);
+    if(ahciPoll(ap, IDE_CMD_IDENTIFY, ap->ident, sizeof(ap->ident)) != 0)
+    {
+        printf("[ahci] port %d: identify failed\n", ap->port);
+        ahciPortStop(p);
+        return -1;
+    }
+    ap->nsect = (sector_t)ap->ident[100] | ((sector_t)ap->ident[101] << 16) |
+                ((sector_t)ap->ident[102] << 32) | ((sector_t)ap->ident[103] << 48);
+
+    // 4. NCQ if both HBA and disk have it (word 76 bit 8),
+    //    queue depth in word 75
+    int depth = 1;
+    ap->ncq = (ahciHba->cap & HBA_CAP_SNCQ) && (ap->ident[76] & (1 << 8));
+    if(ap->ncq)
+    {
+        depth = (ap->ident[75] & 0x1f) + 1;
+        if(depth > ap->nslot)
+        {
+            depth = ap->nslot;
+        }
+    }
+    blkQueueInit(&(ap->q), AHCI_MAX_BLK, depth, ahciStart);
+
+    p->is = 0xffffffff;
+    p->ie = PX_IS_DHRS | PX_IS_SDBS | PX_IS_ERR;
+
+    blkDevRegister(ap->device, "sd", &ahciOps, &(ap->q), ap);
+    printf("[ahci] disk %d on port %d: %d MB, queue depth %d\n", ap->device,
+           ap->port, (int)(ap->nsect >> 11), depth);
+    return 0;
+}
+
+void ahciStart(struct reqQueue *q, struct request *rq)
+{
+    // q is the first member of its port
+    struct ahciPort *ap = (struct ahciPort *)q;
+    struct hbaPort *p = ap->regs;
+
+    // 1. a free slot, the queue never gives more than depth
+    int slot = 0;
+    while(ap->issued & ((uint32_t)1 << slot))
+    {
+        slot++;
+    }
+
+    // 2. PRDT straight on the block buffers, or the segments
+    //    of a bio
+    struct hbaCmdTable *t = ap->ctab[slot];
+    int n = 0;
+    if(rq->bio != NULL)
+    {
+        for(int i = 0; i < rq->bio->nvec; i++)
+        {
+            struct bioVec *v = &(rq->bio->vec[i]);
+            n = ahciPrdBuild(t, n, v->page + v->off, v->len);
+        }
+    }
+    else
+    {
+        for(struct block *b = rq->head; b != NULL; b = b->io_next)
+        {
+            n = ahciPrdBuild(t, n, b->buf, BSIZE);
+        }
+    }
+    t->prdt[n - 1].dbc |= ((uint32_t)1 << 31);
+
+    // 3. NCQ puts the tag in count and sectors in feature
+    int nsect = rq->nblk * SEC_PER_BLK;
+    sector_t lba = rq->block * SEC_PER_BLK;
+    if(ap->ncq)
+    {
+        ahciFis(t, rq->write ? ATA_CMD_W_FPDMA : ATA_CMD_R_FPDMA, lba, slot << 3, nsect);
+    }
+    else
+    {
+        ahciFis(t, rq->write ? ATA_CMD_W_DMA_EXT : ATA_CMD_R_DMA_EXT, lba, nsect, 0);
+    }
+
+    struct hbaCmdHeader *h = &(ap->clist[slot]);
+    h->flags = 5 | (rq->write ? AHCI_CH_WRITE : 0);
+    h->prdtl = n;
+    h->prdbc = 0;
+
+    // 4. issue, tag goes to SActive first
+    ap->slotRq[slot] = rq;
+    ap->issued |= ((uint32_t)1 << slot);
+    if(ap->ncq)
+    {
+        p->sact = ((uint32_t)1 << slot);
+    }
+    p->ci = ((uint32_t)1 << slot);
+}
+
+void ahciInterruptHandler(struct trapframe *tf, void *ctx)
+{
+    uint32_t his = ahciHba->is;
+    for(int i = 0; i < nahciPort; i++)
+    {
+        struct ahciPort *ap = &(ahciPorts[i]);
+        if(!(his & ((uint32_t)1 << ap->port)))
+        {
+            continue;
+        }
+
+        struct request *fin[AHCI_NSLOT];
+        int nfin = 0;
+        struct hbaPort *p = ap->regs;
+        uint32_t eflags = spinlockLockSave(&(ap->q.lock));
+
+        // 1. slots the disk is done with leave both SActive
+        //    and CI. on error all outstanding ones fail, the
+        //    port is restarted which drops them
+        uint32_t pis = p->is;
+        p->is = pis;
+        int err = (pis & PX_IS_ERR) != 0;
+        uint32_t done;
+        if(err)
+        {
+            done = ap->issued;
+            ahciPortStop(p);
+            ahciPortStart(p);
+        }
+        else
+        {
+            done = ap->issued & ~(p->sact | p->ci);
+        }
+
+        // 2. finish them, this may issue new ones
+        ap->issued &= ~done;
+        for(int s = 0; s < ap->nslot; s++)
+        {
+            if(done & ((uint32_t)1 << s))
+            {
+                struct request *rq = ap->slotRq[s];
+                ap->slotRq[s] = NULL;
+                fin[nfin++] = blkComplete(&(ap->q), rq, err);
+            }
+        }
+        spinlockUnlockRestore(&(ap->q.lock), eflags);
+
+        // 3. wake up threads in bottom half
+        for(int k = 0; k < nfin; k++)
+        {
+            if(ringEnqueue(&ahciDone, fin[k]) != 0)
+            {
+                blkWakeup(&(ap->q), fin[k]);
+            }
+        }
+        if(nfin > 0)
+        {
+            bhRaise(MASTER_BOUND + ahciIrq);
+        }
+    }
+    ahciHba->is = his;
+}
+
+void ahciBottomHalf()
+{
+    void *done[8];
+    int n;
+    while((n = ringDequeueBurst(&ahciDone, done, 8)) > 0)
+    {
+        for(int i = 0; i < n; i++)
+        {
+            struct request *rq = done[i];
+            blkWakeup(ahciQueue(rq->device), rq);
+        }
+    }
+}
+
+int ahciRw(struct blkDev *bd, struct block **blks, int n, int write, sector_t start)
+{
+    struct ahciPort *ap = bd->priv;
+    return blkRwAt(&(ap->q), blks, n, write, ap->device, start);
+}
+
+int ahciBio(struct blkDev *bd, struct bio *bio, sector_t start)
+{
+    struct ahciPort *ap = bd->priv;
+    if(blkSubmitBio(&(ap->q), bio, ap->device, start) != 0)
+    {
+        return -1;
+    }
+    return blkWaitBio(&(ap->q), bio);
+}
+
+int ahciFlush(struct blkDev *bd)
+{
+    struct ahciPort *ap = bd->priv;
+    blkDrain(&(ap->q));
+
+    // slot 0 is free with the queue drained, the interrupt
+    // handler finds no slot done and only acks
+    uint32_t eflags = spinlockLockSave(&(ap->q.lock));
+    int err = ahciPoll(ap, ATA_CMD_FLUSH_EXT, NULL, 0);
+    if(err)
+    {
+        ahciPortStop(ap->regs);
+        ahciPortStart(ap->regs);
+    }
+    spinlockUnlockRestore(&(ap->q.lock), eflags);
+
+    blkUndrain(&(ap->q));
+    return err;
+}
+
+sector_t ahciSize(struct blkDev *bd)
+{
+    return ((struct ahciPort *)bd->priv)->nsect / SEC_PER_BLK;
+}
+
+struct blkOps ahciOps = {ahciRw, ahciBio, ahciFlush, ahciSize};
+
+struct reqQueue *ahciQueue(int device)
+{
+    int i = device - AHCI_DEV_BASE;
+    if(i < 0 || i >= nahciPort)
+    {
+        return NULL;
+    }
+    return &(ahciPorts[i].q);
+}
+
+int ahciRead(struct block *blk)
+{
+    struct reqQueue *q = ahciQueue(blk->device);
+    if(q == NULL)
+    {
+        return -1;
+    }
+    blkSubmit(q, blk, 0);
+    return blkWait(q, blk);
+}
+
+int ahciWrite(struct block *blk)
+{
+    struct reqQueue *q = ahciQueue(blk->device);
+    if(q == NULL)
+    {
+        return -1;
+    }
+    blkSubmit(q, blk, 1);
+    return blkWait(q, blk);
+}
@@ -0,0 +1,249 @@
+#ifndef _AHCI_H
+#define _AHCI_H
+
+#include "types.h"
+#include "ide.h"
+#include "blk.h"
+#include "ring.h"
+
+// AHCI SATA host bus adapter
+// the HBA registers are memory mapped at ABAR (BAR5), memory is
+// identity mapped so they are used in place. each port has a
+// command list of 32 slots, a slot points to a command table
+// holding the FIS and the PRDT of a request. disks with NCQ
+// take up to 32 READ/WRITE FPDMA QUEUED commands at once, the
+// others one READ/WRITE DMA EXT at a time
+
+// generic host control
+#define HBA_CAP_SNCQ  (1 << 30) // native command queuing
+#define HBA_CAP_NCS(cap) ((((cap) >> 8) & 0x1f) + 1) // slots
+#define HBA_GHC_HR    (1 << 0)  // HBA reset
+#define HBA_GHC_IE    (1 << 1)  // interrupt enable
+#define HBA_GHC_AE    0x80000000// AHCI enable
+
+// port command and status
+#define PX_CMD_ST  (1 << 0)  // start command list
+#define PX_CMD_FRE (1 << 4)  // FIS receive enable
+#define PX_CMD_FR  (1 << 14) // FIS receive running
+#define PX_CMD_CR  (1 << 15) // command list running
+
+// port interrupt status
+#define PX_IS_DHRS (1 << 0)  // D2H register FIS
+#define PX_IS_PSS  (1 << 1)  // PIO setup FIS
+#define PX_IS_DSS  (1 << 2)  // DMA setup FIS
+#define PX_IS_SDBS (1 << 3)  // set device bits FIS, NCQ done
+#define PX_IS_IFS  (1 << 27) // interface fatal error
+#define PX_IS_HBDS (1 << 28) // host bus data error
+#define PX_IS_HBFS (1 << 29) // host bus fatal error
+#define PX_IS_TFES (1 << 30) // task file error
+#define PX_IS_ERR  (PX_IS_IFS | PX_IS_HBDS | PX_IS_HBFS | PX_IS_TFES)
+
+#define PX_TFD_ERR 0x01 // task file status ERR
+#define PX_TFD_DRQ 0x08
+#define PX_TFD_BSY 0x80
+
+#define PX_SSTS_DET(s) ((s) & 0xf)        // 3: device and phy
+#define PX_SSTS_IPM(s) (((s) >> 8) & 0xf) // 1: active
+#define PX_SIG_ATA 0x00000101            // SATA disk
+
+struct hbaPort
+{
+    volatile uint32_t clb;  // command list base, 1KB aligned
+    volatile uint32_t clbu;
+    volatile uint32_t fb;   // FIS base, 256 bytes aligned
+    volatile uint32_t fbu;
+    volatile uint32_t is;   // interrupt status
+    volatile uint32_t ie;   // interrupt enable
+    volatile uint32_t cmd;  // command and status
+    volatile uint32_t rsv0;
+    volatile uint32_t tfd;  // task file data
+    volatile uint32_t sig;  // signature
+    volatile uint32_t ssts; // SATA status
+    volatile uint32_t sctl; // SATA control
+    volatile uint32_t serr; // SATA error
+    volatile uint32_t sact; // NCQ tags outstanding
+    volatile uint32_t ci;   // command issue
+    volatile uint32_t sntf;
+    volatile uint32_t fbs;
+    volatile uint32_t rsv1[11];
+    volatile uint32_t vendor[4];
+};
+
+struct hbaMem
+{
+    volatile uint32_t cap; // capabilities
+    volatile uint32_t ghc; // global host control
+    volatile uint32_t is;  // interrupt status, a bit per port
+    volatile uint32_t pi;  // ports implemented
+    volatile uint32_t vs;  // version
+    volatile uint32_t ccc_ctl;
+    volatile uint32_t ccc_pts;
+    volatile uint32_t em_loc;
+    volatile uint32_t em_ctl;
+    volatile uint32_t cap2;
+    volatile uint32_t bohc;
+    uint8_t rsv[0x100 - 0x2c];
+    struct hbaPort ports[32];
+};
+
+// command header, one per slot in command list
+struct hbaCmdHeader
+{
+    uint16_t flags;  // FIS length in dwords, AHCI_CH_*
+    uint16_t prdtl;  // PRDT entries
+    volatile uint32_t prdbc; // bytes transferred
+    uint32_t ctba;   // command table base, 128 bytes aligned
+    uint32_t ctbau;
+    uint32_t rsv[4];
+};
+
+#define AHCI_CH_WRITE    (1 << 6) // host to device
+#define AHCI_CH_PREFETCH (1 << 7)
+#define AHCI_CH_CLEAR    (1 << 10) // clear busy upon R_OK
+
+struct hbaPrd
+{
+    uint32_t dba;  // data base address
+    uint32_t dbau;
+    uint32_t rsv;
+    uint32_t dbc;  // byte count - 1, bit 31 interrupt
+};
+
+#define AHCI_NPRD 248 // a command table fills one page
+
+struct hbaCmdTable
+{
+    uint8_t cfis[64]; // command FIS
+    uint8_t acmd[16]; // ATAPI command
+    uint8_t rsv[48];
+    struct hbaPrd prdt[AHCI_NPRD];
+};
+
+// host to device register FIS
+#define FIS_TYPE_H2D 0x27
+#define FIS_H2D_CMD  0x80 // command, not control
+
+#define ATA_CMD_R_DMA_EXT  0x25
+#define ATA_CMD_W_DMA_EXT  0x35
+#define ATA_CMD_R_FPDMA    0x60 // NCQ read
+#define ATA_CMD_W_FPDMA    0x61 // NCQ write
+#define ATA_CMD_FLUSH_EXT  0xea // flush write cache
+#define ATA_DEV_LBA        0x40
+
+#define AHCI_NSLOT    32
+#define AHCI_NPORT    4  // ports driven
+#define AHCI_DEV_BASE 2  // device number of first port, after IDE
+#define AHCI_MAX_BLK  (AHCI_NPRD / 2) // a block may cross a page
+
+struct ahciPort
+{
+    struct reqQueue q;           // first, start() casts it back
+    int device;                  // device number
+    int port;                    // port number on the HBA
+    struct hbaPort *regs;
+    struct hbaCmdHeader *clist;  // command list
+    struct hbaCmdTable *ctab[AHCI_NSLOT];
+    int nslot;                   // slots of the HBA
+    int ncq;                     // use FPDMA QUEUED commands
+    uint32_t issued;             // slots in use
+    struct request *slotRq[AHCI_NSLOT];
+    sector_t nsect;              // addressable sectors
+    uint16_t ident[256];         // identify data
+};
+
+struct hbaMem *ahciHba;
+struct ahciPort ahciPorts[AHCI_NPORT];
+int nahciPort;
+int ahciIrq;
+
+// finished requests, from interrupt handler to bottom half
+#define AHCI_NDONE 64
+struct ring ahciDone;
+void *ahciDoneSlots[AHCI_NDONE];
+
+// ahciInit: find AHCI controller on PCI, bring up ports with
+//           a SATA disk and their request queues
+// parameters: void
+// outputs   : number of disks, -1 if there is no AHCI
+int ahciInit();
+
+// ahciPortInit: stop port, set up command list, FIS area and
+//               command tables, identify the disk and start
+// parameters: ap-port
+// outputs   : success or not
+int ahciPortInit(struct ahciPort *ap);
+
+// ahciPortStop: stop command list and FIS receive of a port,
+//               outstanding commands are dropped
+// parameters: p-port registers
+// outputs   : void
+void ahciPortStop(struct hbaPort *p);
+
+// ahciPortStart: clear errors and start a stopped port
+// parameters: p-port registers
+// outputs   : void
+void ahciPortStart(struct hbaPort *p);
+
+// ahciStart: issue rq in a free slot, start function of the
+//            port queue
+// parameters: q-queue of the port
+//             rq-request
+// outputs   : void
+void ahciStart(struct reqQueue *q, struct request *rq);
+
+// ahciInterruptHandler: finish slots the disk is done with
+// parameters: tf-trapframe
+//             ctx-unused
+// outputs   : void
+void ahciInterruptHandler(struct trapframe *tf, void *ctx);
+
+// ahciBottomHalf: wake up threads whose requests are finished
+// parameters: void
+// outputs   : void
+void ahciBottomHalf();
+
+struct blkOps ahciOps; // ahciRw, ahciBio, ahciFlush, ahciSize
+
+// ahciRw: rw operation of AHCI disks, on the port queue
+// parameters: bd-disk, priv is the port
+//             blks-blocks
+//             n-number of blocks
+//             write-1 write, 0 read
+//             start-offset on the disk
+// outputs   : success or not
+int ahciRw(struct blkDev *bd, struct block **blks, int n, int write, sector_t start);
+
+// ahciBio: bio operation of AHCI disks, PRDT on the segments
+// parameters: bd-disk, priv is the port
+//             bio-bio
+//             start-offset on the disk
+// outputs   : success or not
+int ahciBio(struct blkDev *bd, struct bio *bio, sector_t start);
+
+// ahciFlush: flush operation of AHCI disks, FLUSH CACHE EXT
+//            with the port queue drained, polled
+// parameters: bd-disk, priv is the port
+// outputs   : success or not
+int ahciFlush(struct blkDev *bd);
+
+// ahciSize: size operation of AHCI disks
+// parameters: bd-disk, priv is the port
+// outputs   : blocks on disk
+sector_t ahciSize(struct blkDev *bd);
+
+// ahciQueue: request queue of a device
+// parameters: device-device number
+// outputs   : queue, NULL if the device is not an AHCI disk
+struct reqQueue *ahciQueue(int device);
+
+// ahciRead: read a block from AHCI disk blk->device
+// parameters: blk-read into this block
+// outputs   : success or not
+int ahciRead(struct block *blk);
+
+// ahciWrite: write a block to AHCI disk blk->device
+// parameters: blk-write this block to disk
+// outputs   : success or not
+int ahciWrite(struct block *blk);
+
+#endif // _AHCI_H
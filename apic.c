@@ -0,0 +1,183 @@
+#include "apic.h"
+#include "acpi.h"
+#include "port.h"
+#include "timer.h"
+#include "idt.h"
+#include "console.h"
+
+uint32_t lapicRead(int reg)
+{
+    return lapic[reg / 4];
+}
+
+void lapicWrite(int reg, uint32_t val)
+{
+    lapic[reg / 4] = val;
+    // wait for write to finish, by reading
+    lapic[LAPIC_ID / 4];
+}
+
+uint32_t ioapicRead(int reg)
+{
+    ioapic[IOAPIC_REGSEL / 4] = reg;
+    return ioapic[IOAPIC_DATA / 4];
+}
+
+void ioapicWrite(int reg, uint32_t val)
+{
+    ioapic[IOAPIC_REGSEL / 4] = reg;
+    ioapic[IOAPIC_DATA / 4] = val;
+}
+
+int apicInit()
+{
+    haveApic = 0;
+    if(acpiInit() != 0)
+    {
+        return -1;
+    }
+
+    lapic = (volatile uint32_t *)acpi.lapicAddr;
+    ioapic = (volatile uint32_t *)acpi.ioapicAddr;
+
+    // mask all 8259 irqs, they come through I/O APIC now
+    outb(PIC_MASTER_DATA, 0xff);
+    outb(PIC_SLAVE_DATA, 0xff);
+
+    lapicInit();
+    ioapicInit();
+    haveApic = 1;
+
+    return 0;
+}
+
+void lapicInit()
+{
+    // enable local APIC, set spurious interrupt vector
+    lapicWrite(LAPIC_SVR, LAPIC_SVR_ENABLE | IV_SPURIOUS);
+
+    // timer is off until lapicTimerInit
+    lapicWrite(LAPIC_TIMER, LAPIC_MASKED | IV_TIMER);
+
+    // mask local interrupt pins
+    lapicWrite(LAPIC_LINT0, LAPIC_MASKED);
+    lapicWrite(LAPIC_LINT1, LAPIC_MASKED);
+
+    // performance counter overflow, since version 4
+    if(((lapicRead(LAPIC_VER) >> 16) & 0xff) >= 4)
+    {
+        lapicWrite(LAPIC_PCINT, LAPIC_MASKED);
+    }
+
+    lapicWrite(LAPIC_ERROR, IV_APIC_ERROR);
+
+    // clear error status, write twice as required
+    lapicWrite(LAPIC_ESR, 0);
+    lapicWrite(LAPIC_ESR, 0);
+
+    // ack any outstanding interrupt
+    lapicWrite(LAPIC_EOI, 0);
+
+    // accept all interrupts
+    lapicWrite(LAPIC_TPR, 0);
+}
+
+int lapicId()
+{
+    if(lapic == NULL)
+    {
+        return 0;
+    }
+    return lapicRead(LAPIC_ID) >> 24;
+}
+
+void lapicEoi()
+{
+    lapic[LAPIC_EOI / 4] = 0;
+}
+
+void lapicTimerInit(int freq)
+{
+    // 1. count how far APIC timer goes in one tick, using
+    //    PIT channel 2 in one-shot mode
+    if(lapicTicks == 0)
+    {
+        uint32_t cnt = FREQUENCY / freq;
+        outb(PIT_GATE_PORT, (inb(PIT_GATE_PORT) & 0xfd) | 0x1);
+        outb(PIT_CMD_PORT, 0xb0);
+        outb(CHAN2_DATA_PORT, cnt & 0xff);
+        outb(CHAN2_DATA_PORT, (cnt >> 8) & 0xff);
+
+        // restart channel 2 by toggling its gate
+        uint8_t gate = inb(PIT_GATE_PORT) & 0xfe;
+        outb(PIT_GATE_PORT, gate);
+        outb(PIT_GATE_PORT, gate | 0x1);
+
+        lapicWrite(LAPIC_TDCR, LAPIC_TDCR_X16);
+        lapicWrite(LAPIC_TICR, 0xffffffff);
+        while((inb(PIT_GATE_PORT) & 0x20) == 0);
+        lapicTicks = 0xffffffff - lapicRead(LAPIC_TCCR);
+    }
+
+    // 2. periodic timer on IV_TIMER
+    lapicWrite(LAPIC_TDCR, LAPIC_TDCR_X16);
+    lapicWrite(LAPIC_TIMER, LAPIC_PERIODIC | IV_TIMER);
+    lapicWrite(LAPIC_TICR, lapicTicks);
+}
+
+void lapicWait()
+{
+    while(lapicRead(LAPIC_ICRLO) & ICR_DELIVS);
+}
+
+void ioapicInit()
+{
+    int maxintr = (ioapicRead(IOAPIC_REG_VER) >> 16) & 0xff;
+
+    // mask all, drivers enable what they use
+    for(int i = 0; i <= maxintr; i++)
+    {
+        ioapicWrite(IOAPIC_REG_TABLE + 2 * i, IOAPIC_MASKED | (MASTER_BOUND + i));
+        ioapicWrite(IOAPIC_REG_TABLE + 2 * i + 1, 0);
+    }
+}
+
+// ioapicEntry: redirection entry of ISA irq, and its flags
+int ioapicEntry(int irq, uint32_t *flags)
+{
+    *flags = 0;
+    if(irq < 16)
+    {
+        uint16_t f = acpi.isaFlags[irq];
+        if((f & MADT_POLARITY_MASK) == MADT_POLARITY_LOW)
+        {
+            *flags |= IOAPIC_ACTIVELOW;
+        }
+        if((f & MADT_TRIGGER_MASK) == MADT_TRIGGER_LEVEL)
+        {
+            *flags |= IOAPIC_LEVEL;
+        }
+        return acpi.isaGsi[irq] - acpi.ioapicGsiBase;
+    }
+    return irq - acpi.ioapicGsiBase;
+}
+
+void ioapicEnable(int irq, int vector, int apicid)
+{
+    uint32_t flags;
+    int entry = ioapicEntry(irq, &flags);
+
+    // edge triggered, active high unless overridden,
+    // physical destination apicid
+    ioapicWrite(IOAPIC_REG_TABLE + 2 * entry, flags | vector);
+    ioapicWrite(IOAPIC_REG_TABLE + 2 * entry + 1, apicid << 24);
+}
+
+void ioapicDisable(int irq)
+{
+    uint32_t flags;
+    int entry = ioapicEntry(irq, &flags);
+
+    ioapicWrite(IOAPIC_REG_TABLE + 2 * entry, IOAPIC_MASKED | (MASTER_BOUND + irq));
+    ioapicWrite(IOAPIC_REG_TABLE + 2 * entry + 1, 0);
+}
@@ -0,0 +1,122 @@
+#ifndef _APIC_H
+#define _APIC_H
+
+#include "types.h"
+
+// local APIC registers, offsets in bytes
+#define LAPIC_ID    0x020 // id
+#define LAPIC_VER   0x030 // version
+#define LAPIC_TPR   0x080 // task priority
+#define LAPIC_EOI   0x0b0 // end of interrupt
+#define LAPIC_SVR   0x0f0 // spurious interrupt vector
+#define LAPIC_ESR   0x280 // error status
+#define LAPIC_ICRLO 0x300 // interrupt command
+#define LAPIC_ICRHI 0x310 // interrupt command, destination
+#define LAPIC_TIMER 0x320 // local vector table: timer
+#define LAPIC_PCINT 0x340 // local vector table: performance counter
+#define LAPIC_LINT0 0x350 // local vector table: LINT0
+#define LAPIC_LINT1 0x360 // local vector table: LINT1
+#define LAPIC_ERROR 0x370 // local vector table: error
+#define LAPIC_TICR  0x380 // timer initial count
+#define LAPIC_TCCR  0x390 // timer current count
+#define LAPIC_TDCR  0x3e0 // timer divide configuration
+
+#define LAPIC_SVR_ENABLE   0x100
+#define LAPIC_MASKED       0x10000
+#define LAPIC_PERIODIC     0x20000
+#define LAPIC_TDCR_X16     0x3
+
+// interrupt command register
+#define ICR_INIT      0x500
+#define ICR_STARTUP   0x600
+#define ICR_DELIVS    0x1000  // delivery status
+#define ICR_ASSERT    0x4000
+#define ICR_DEASSERT  0x0
+#define ICR_LEVEL     0x8000
+#define ICR_BCAST     0x80000 // all including self
+#define ICR_OTHERS    0xc0000 // all excluding self
+
+// I/O APIC, index/data register pair
+#define IOAPIC_REGSEL 0x00
+#define IOAPIC_DATA   0x10
+
+#define IOAPIC_REG_ID    0x00
+#define IOAPIC_REG_VER   0x01
+#define IOAPIC_REG_TABLE 0x10 // redirection table, 2 registers each
+
+#define IOAPIC_MASKED    0x10000
+#define IOAPIC_LEVEL     0x08000
+#define IOAPIC_ACTIVELOW 0x02000
+#define IOAPIC_LOGICAL   0x00800
+
+// PIT channel 2 gate, used to calibrate APIC timer
+#define PIT_GATE_PORT 0x61
+
+// local APIC and I/O APIC mapped registers, identity mapped
+volatile uint32_t *lapic;
+volatile uint32_t *ioapic;
+// 1 if interrupts go through APIC, 0 if through 8259 PIC
+int haveApic;
+// APIC timer counts per timer tick (1 / SET_FREQ second)
+uint32_t lapicTicks;
+
+// apicInit: find APICs from ACPI, disable 8259 PIC and
+//           initialize local APIC and I/O APIC
+// parameters: void
+// outputs   : 0-use APIC, -1-no APIC, stay on 8259 PIC
+int apicInit();
+
+// lapicRead: read local APIC register
+// parameters: reg-register offset
+// outputs   : register value
+uint32_t lapicRead(int reg);
+
+// lapicWrite: write local APIC register
+// parameters: reg-register offset
+//             val-value
+// outputs   : void
+void lapicWrite(int reg, uint32_t val);
+
+// lapicInit: initialize local APIC of this cpu
+// parameters: void
+// outputs   : void
+void lapicInit();
+
+// lapicId: local APIC id of this cpu
+// parameters: void
+// outputs   : APIC id
+int lapicId();
+
+// lapicEoi: acknowledge interrupt, a MMIO write
+// parameters: void
+// outputs   : void
+void lapicEoi();
+
+// lapicTimerInit: start periodic APIC timer, calibrated with PIT
+// parameters: freq-interrupts per second
+// outputs   : void
+void lapicTimerInit(int freq);
+
+// lapicWait: wait until a sent IPI is delivered
+// parameters: void
+// outputs   : void
+void lapicWait();
+
+// ioapicInit: mask all redirection entries
+// parameters: void
+// outputs   : void
+void ioapicInit();
+
+// ioapicEnable: route ISA irq to vector on cpu
+// parameters: irq-ISA irq
+//             vector-interrupt vector
+//             apicid-destination cpu's APIC id
+// outputs   : void
+void ioapicEnable(int irq, int vector, int apicid);
+
+// ioapicDisable: mask ISA irq
+// parameters: irq-ISA irq
+// outputs   : void
+void ioapicDisable(int irq);
+
+#endif // _APIC_H
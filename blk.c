@@ -0,0 +1,865 @@
+#include "blk.h"
+#include "ide.h"
+#include "thread.h"
+#include "cpu.h"
+#include "console.h"
+#include "ramdisk.h"
+
+void blkQueueInit(struct reqQueue *q, int maxBlk, int depth,
+                  void (*start)(struct reqQueue *q, struct request *rq))
+{
+    spinlockInit(&(q->lock));
+    q->head = NULL;
+    q->nactive = 0;
+    q->depth = depth;
+    q->device = 0;
+    q->pos = 0;
+    q->plugged = 0;
+    q->maxBlk = maxBlk;
+    q->start = start;
+
+    q->freeList = NULL;
+    for(int i = 0; i < NREQ; i++)
+    {
+        q->reqs[i].next = q->freeList;
+        q->freeList = &(q->reqs[i]);
+    }
+}
+
+// reqBefore: rq sorts before (device, block)
+int reqBefore(struct request *rq, int device, sector_t block)
+{
+    return rq->device < device ||
+           (rq->device == device && rq->block < block);
+}
+
+// blkDispatch: give requests in C-LOOK order to the driver
+//              until it has depth of them, plugged or not,
+//              with q->lock
+void blkDispatch(struct reqQueue *q)
+{
+    while(q->nactive < q->depth && q->head != NULL)
+    {
+        // first request at or after the position, else wrap
+        // around to the lowest one
+        struct request **pp = &(q->head);
+        while(*pp != NULL && reqBefore(*pp, q->device, q->pos))
+        {
+            pp = &((*pp)->next);
+        }
+        if(*pp == NULL)
+        {
+            pp = &(q->head);
+        }
+
+        struct request *rq = *pp;
+        *pp = rq->next;
+        rq->next = NULL;
+        q->nactive++;
+        q->device = rq->device;
+        q->pos = rq->block + rq->nblk;
+        q->start(q, rq);
+    }
+}
+
+void blkRun(struct reqQueue *q)
+{
+    if(q->plugged == 0)
+    {
+        blkDispatch(q);
+    }
+}
+
+// blkMergeNext: join rq and the one after it if they meet
+int blkMergeNext(struct reqQueue *q, struct request *rq)
+{
+    struct request *nx = rq->next;
+    if(nx == NULL || rq->bio != NULL || nx->bio != NULL ||
+       nx->device != rq->device || nx->write != rq->write ||
+       nx->block != rq->block + rq->nblk || rq->nblk + nx->nblk > q->maxBlk)
+    {
+        return 0;
+    }
+
+    // sleepers on nx wake up and go to sleep on rq
+    for(struct block *b = nx->head; b != NULL; b = b->io_next)
+    {
+        b->io_rq = rq;
+    }
+    thrCondBroadcast(nx);
+
+    rq->tail->io_next = nx->head;
+    rq->tail = nx->tail;
+    rq->nblk += nx->nblk;
+    rq->next = nx->next;
+    nx->next = q->freeList;
+    q->freeList = nx;
+    return 1;
+}
+
+// blkAllocReq: take a free request and link it in sorted place,
+//              with q->lock. out of requests the queue is pushed
+//              to the driver even if plugged, until one is freed
+struct request *blkAllocReq(struct reqQueue *q, int device, sector_t block)
+{
+    while(q->freeList == NULL)
+    {
+        blkDispatch(q);
+        if(thr_current != NULL)
+        {
+            thrCondWait(&(q->freeList), &(q->lock));
+        }
+        else
+        {
+            spinlockUnlock(&(q->lock));
+            cpuRelax();
+            spinlockLock(&(q->lock));
+        }
+    }
+
+    // the queue may have changed while waiting
+    struct request *prev = NULL;
+    struct request *rq = q->head;
+    while(rq != NULL && reqBefore(rq, device, block))
+    {
+        prev = rq;
+        rq = rq->next;
+    }
+
+    struct request *nrq = q->freeList;
+    q->freeList = nrq->next;
+    nrq->device = device;
+    nrq->block = block;
+    nrq->next = rq;
+    if(prev == NULL)
+    {
+        q->head = nrq;
+    }
+    else
+    {
+        prev->next = nrq;
+    }
+    return nrq;
+}
+
+void blkSubmit(struct reqQueue *q, struct block *blk, int write)
+{
+    blkSubmitAt(q, blk, write, blk->device, blk->block);
+}
+
+void blkSubmitAt(struct reqQueue *q, struct block *blk, int write,
+                 int device, sector_t block)
+{
+    spinlockLock(&(q->lock));
+    blk->flags &= ~(B_VALID | B_ERROR);
+    blk->flags = write ? (blk->flags | B_DIRTY) : (blk->flags & ~B_DIRTY);
+    blk->io_next = NULL;
+
+    // 1. find the place of blk, prev is the last request
+    //    before it
+    struct request *prev = NULL;
+    struct request *rq = q->head;
+    while(rq != NULL && reqBefore(rq, device, block))
+    {
+        prev = rq;
+        rq = rq->next;
+    }
+
+    // 2. back merge, blk follows prev
+    if(prev != NULL && prev->bio == NULL &&
+       prev->device == device && prev->write == write &&
+       prev->block + prev->nblk == block && prev->nblk < q->maxBlk)
+    {
+        prev->tail->io_next = blk;
+        prev->tail = blk;
+        prev->nblk++;
+        blk->io_rq = prev;
+        blkMergeNext(q, prev);
+        blkRun(q);
+        spinlockUnlock(&(q->lock));
+        return ;
+    }
+
+    // 3. front merge, blk comes before rq
+    if(rq != NULL && rq->bio == NULL &&
+       rq->device == device && rq->write == write &&
+       rq->block == block + 1 && rq->nblk < q->maxBlk)
+    {
+        blk->io_next = rq->head;
+        blk->io_rq = rq;
+        rq->head = blk;
+        rq->block = block;
+        rq->nblk++;
+        blkRun(q);
+        spinlockUnlock(&(q->lock));
+        return ;
+    }
+
+    // 4. new request
+    struct request *nrq = blkAllocReq(q, device, block);
+    nrq->nblk = 1;
+    nrq->write = write;
+    nrq->head = blk;
+    nrq->tail = blk;
+    nrq->bio = NULL;
+    blk->io_rq = nrq;
+
+    blkRun(q);
+    spinlockUnlock(&(q->lock));
+}
+
+void bioInit(struct bio *bio, int device, sector_t block, int write)
+{
+    bio->device = device;
+    bio->block = block;
+    bio->nblk = 0;
+    bio->write = write;
+    bio->flags = 0;
+    bio->nvec = 0;
+}
+
+int bioAdd(struct bio *bio, char *page, uint32_t off, uint32_t len)
+{
+    if(len == 0 || len % BSIZE != 0 || ((uint32_t)(page + off) & 1) ||
+       bio->nblk + len / BSIZE > BIO_MAX_BLK)
+    {
+        return -1;
+    }
+
+    struct bioVec *v = (bio->nvec > 0) ? &(bio->vec[bio->nvec - 1]) : NULL;
+    if(v != NULL && v->page + v->off + v->len == page + off)
+    {
+        v->len += len;
+    }
+    else if(bio->nvec < BIO_NVEC)
+    {
+        v = &(bio->vec[bio->nvec++]);
+        v->page = page;
+        v->off = off;
+        v->len = len;
+    }
+    else
+    {
+        return -1;
+    }
+    bio->nblk += len / BSIZE;
+    return 0;
+}
+
+int blkSubmitBio(struct reqQueue *q, struct bio *bio, int device, sector_t start)
+{
+    if(bio->nblk == 0 || bio->nblk > q->maxBlk)
+    {
+        return -1;
+    }
+
+    spinlockLock(&(q->lock));
+    bio->flags = 0;
+    struct request *rq = blkAllocReq(q, device, bio->block + start);
+    rq->nblk = bio->nblk;
+    rq->write = bio->write;
+    rq->head = NULL;
+    rq->tail = NULL;
+    rq->bio = bio;
+    bio->rq = rq;
+    blkRun(q);
+    spinlockUnlock(&(q->lock));
+    return 0;
+}
+
+struct request *blkComplete(struct reqQueue *q, struct request *rq, int err)
+{
+    if(rq->bio != NULL)
+    {
+        rq->bio->flags = err ? B_ERROR : B_VALID;
+    }
+
+    // blocks may be submitted again as soon as they are
+    // valid, rq keeps its own record until blkWakeup
+    for(struct block *b = rq->head; b != NULL; b = b->io_next)
+    {
+        b->flags = err ? (b->flags | B_ERROR) : ((b->flags & ~B_DIRTY) | B_VALID);
+    }
+
+    // keep the disk busy with next request
+    q->nactive--;
+    blkRun(q);
+    return rq;
+}
+
+void blkWakeup(struct reqQueue *q, struct request *rq)
+{
+    // also called by interrupt handler, keep IF as it is
+    uint32_t eflags = spinlockLockSave(&(q->lock));
+    // waiters sleep on the request, not on blocks whose
+    // io_next may be reset by a new submit already
+    thrCondBroadcast(rq);
+    rq->next = q->freeList;
+    q->freeList = rq;
+    thrCondBroadcast(&(q->freeList));
+    spinlockUnlockRestore(&(q->lock), eflags);
+}
+
+// blkWaitOn: wait until *flags is B_VALID or B_ERROR, on the
+//            condition variable in *cv, which a merge may move
+int blkWaitOn(struct reqQueue *q, void * volatile *cv, volatile int *flags)
+{
+    spinlockLock(&(q->lock));
+    // no thread yet at boot, wait with interrupts on instead
+    while(!(*flags & (B_VALID | B_ERROR)))
+    {
+        if(thr_current != NULL)
+        {
+            thrCondWait(*cv, &(q->lock));
+        }
+        else
+        {
+            spinlockUnlock(&(q->lock));
+            cpuRelax();
+            spinlockLock(&(q->lock));
+        }
+    }
+    spinlockUnlock(&(q->lock));
+
+    return (*flags & B_ERROR) ? -1 : 0;
+}
+
+int blkWait(struct reqQueue *q, struct block *blk)
+{
+    return blkWaitOn(q, (void **)&(blk->io_rq), &(blk->flags));
+}
+
+int blkWaitBio(struct reqQueue *q, struct bio *bio)
+{
+    return blkWaitOn(q, (void **)&(bio->rq), &(bio->flags));
+}
+
+void blkDrain(struct reqQueue *q)
+{
+    spinlockLock(&(q->lock));
+    q->plugged++;
+    while(q->nactive > 0)
+    {
+        if(thr_current != NULL)
+        {
+            thrCondWait(&(q->freeList), &(q->lock));
+        }
+        else
+        {
+            spinlockUnlock(&(q->lock));
+            cpuRelax();
+            spinlockLock(&(q->lock));
+        }
+    }
+
+    // the disk looks full, not even a queue out of requests
+    // dispatches now
+    q->nactive = q->depth;
+    spinlockUnlock(&(q->lock));
+}
+
+void blkUndrain(struct reqQueue *q)
+{
+    spinlockLock(&(q->lock));
+    q->nactive = 0;
+    q->plugged--;
+    blkRun(q);
+    spinlockUnlock(&(q->lock));
+    thrCondBroadcast(&(q->freeList));
+}
+
+void blkPlug(struct reqQueue *q)
+{
+    spinlockLock(&(q->lock));
+    q->plugged++;
+    spinlockUnlock(&(q->lock));
+}
+
+void blkUnplug(struct reqQueue *q)
+{
+    spinlockLock(&(q->lock));
+    if(--q->plugged == 0)
+    {
+        blkRun(q);
+    }
+    spinlockUnlock(&(q->lock));
+}
+
+int blkRw(struct reqQueue *q, struct block **blks, int n, int write)
+{
+    return blkRwAt(q, blks, n, write, -1, 0);
+}
+
+int blkRwAt(struct reqQueue *q, struct block **blks, int n, int write,
+            int device, sector_t start)
+{
+    // plug so the whole burst is merged and sorted before
+    // the disk sees it
+    blkPlug(q);
+    for(int i = 0; i < n; i++)
+    {
+        struct block *b = blks[i];
+        blkSubmitAt(q, b, write, (device < 0) ? b->device : device, b->block + start);
+    }
+    blkUnplug(q);
+
+    int err = 0;
+    for(int i = 0; i < n; i++)
+    {
+        if(blkWait(q, blks[i]) != 0)
+        {
+            err = -1;
+        }
+    }
+    return err;
+}
+
+int blkDevRegister(int device, char *name, struct blkOps *ops,
+                   struct reqQueue *q, void *priv)
+{
+    if(device < 0 || device >= NBLKDEV || blkDevs[device].ops != NULL)
+    {
+        return -1;
+    }
+    blkDevs[device].name = name;
+    blkDevs[device].q = q;
+    blkDevs[device].priv = priv;
+    blkDevs[device].ops = ops;
+    return 0;
+}
+
+struct blkDev *blkDevGet(int device)
+{
+    if(device < 0 || device >= NBLKDEV || blkDevs[device].ops == NULL)
+    {
+        return NULL;
+    }
+    return &(blkDevs[device]);
+}
+
+int blkDevRw(struct block **blks, int n, int write)
+{
+    if(n <= 0)
+    {
+        return 0;
+    }
+    struct blkDev *bd = blkDevGet(blks[0]->device);
+    if(bd == NULL)
+    {
+        return -1;
+    }
+    return bd->ops->rw(bd, blks, n, write, 0);
+}
+
+int blkDevRead(struct block *blk)
+{
+    return blkDevRw(&blk, 1, 0);
+}
+
+int blkDevWrite(struct block *blk)
+{
+    return blkDevRw(&blk, 1, 1);
+}
+
+int blkDevBio(struct bio *bio)
+{
+    struct blkDev *bd = blkDevGet(bio->device);
+    if(bd == NULL || bd->ops->bio == NULL)
+    {
+        return -1;
+    }
+    return bd->ops->bio(bd, bio, 0);
+}
+
+int blkDevFlush(int device)
+{
+    struct blkDev *bd = blkDevGet(device);
+    if(bd == NULL)
+    {
+        return -1;
+    }
+    return (bd->ops->flush != NULL) ? bd->ops->flush(bd) : 0;
+}
+
+sector_t blkDevSize(int device)
+{
+    struct blkDev *bd = blkDevGet(device);
+    if(bd == NULL)
+    {
+        return 0;
+    }
+    return bd->ops->size(bd);
+}
+
+int partRw(struct blkDev *bd, struct block **blks, int n, int write, sector_t start)
+{
+    struct blkPart *pt = bd->priv;
+    struct blkDev *pd = blkDevGet(pt->parent);
+    for(int i = 0; i < n; i++)
+    {
+        if(blks[i]->block >= pt->nblk)
+        {
+            return -1;
+        }
+    }
+
+    // blocks keep their partition device and block, they are
+    // in the cache by them. the disk driver adds the offset
+    // in its requests
+    return pd->ops->rw(pd, blks, n, write, start + pt->start);
+}
+
+int partBio(struct blkDev *bd, struct bio *bio, sector_t start)
+{
+    struct blkPart *pt = bd->priv;
+    struct blkDev *pd = blkDevGet(pt->parent);
+    if(pd->ops->bio == NULL || bio->block + bio->nblk > pt->nblk)
+    {
+        return -1;
+    }
+    return pd->ops->bio(pd, bio, start + pt->start);
+}
+
+int partFlush(struct blkDev *bd)
+{
+    return blkDevFlush(((struct blkPart *)bd->priv)->parent);
+}
+
+sector_t partSize(struct blkDev *bd)
+{
+    return ((struct blkPart *)bd->priv)->nblk;
+}
+
+struct blkOps partOps = {partRw, partBio, partFlush, partSize};
+
+int blkPartAdd(int parent, sector_t start, sector_t nsect)
+{
+    for(int i = 0; i < NBLKPART; i++)
+    {
+        int device = BLK_DEV_PART + i;
+        if(blkDevs[device].ops != NULL)
+        {
+            continue;
+        }
+
+        struct blkPart *pt = &(blkParts[i]);
+        pt->parent = parent;
+        pt->start = start / SEC_PER_BLK;
+        pt->nblk = nsect / SEC_PER_BLK;
+        blkDevRegister(device, blkDevs[parent].name, &partOps, NULL, pt);
+        printf("[blk] disk %d partition %d: %d MB at sector %d\n", parent,
+               device, (int)(nsect >> 11), (int)start);
+        return device;
+    }
+    return -1;
+}
+
+// "EFI PART" read as little endian
+#define GPT_SIGNATURE 0x5452415020494645ULL
+
+struct block blkPartBuf;
+
+// blkGptScan: partitions of a GPT disk, header at LBA 1. BSIZE
+//             is SECSIZE, an LBA is a block
+int blkGptScan(int device)
+{
+    struct block *b = &blkPartBuf;
+    b->device = device;
+    b->block = 1;
+    if(blkDevRead(b) != 0 || *(uint64_t *)b->buf != GPT_SIGNATURE)
+    {
+        return -1;
+    }
+
+    sector_t elba = *(uint64_t *)(b->buf + 72);
+    uint32_t nent = *(uint32_t *)(b->buf + 80);
+    uint32_t esize = *(uint32_t *)(b->buf + 84);
+    if(esize < 48 || esize > BSIZE)
+    {
+        return -1;
+    }
+
+    int nparts = 0;
+    sector_t cur = (sector_t)-1;
+    for(uint32_t i = 0; i < nent && nparts < NBLKPART; i++)
+    {
+        uint32_t off = i * esize;
+        if(cur != elba + off / BSIZE)
+        {
+            cur = elba + off / BSIZE;
+            b->block = cur;
+            if(blkDevRead(b) != 0)
+            {
+                return -1;
+            }
+        }
+
+        // type GUID all zero: unused entry
+        uint8_t *e = (uint8_t *)b->buf + off % BSIZE;
+        uint32_t *type = (uint32_t *)e;
+        if((type[0] | type[1] | type[2] | type[3]) == 0)
+        {
+            continue;
+        }
+        sector_t first = *(uint64_t *)(e + 32);
+        sector_t last = *(uint64_t *)(e + 40);
+        if(blkPartAdd(device, first, last - first + 1) < 0)
+        {
+            break;
+        }
+        nparts++;
+    }
+    return nparts;
+}
+
+int blkPartScan(int device)
+{
+    struct block *b = &blkPartBuf;
+    b->device = device;
+    b->block = 0;
+    if(blkDevRead(b) != 0)
+    {
+        return -1;
+    }
+
+    uint8_t *s = (uint8_t *)b->buf;
+    if(s[510] != 0x55 || s[511] != 0xaa)
+    {
+        return 0;
+    }
+
+    // 4 primary entries from 446: type at 4, first sector at
+    // 8, sectors at 12. type 0xee is protective MBR of GPT
+    int nparts = 0;
+    uint32_t ent[4][3];
+    for(int i = 0; i < 4; i++)
+    {
+        uint8_t *e = s + 446 + 16 * i;
+        ent[i][0] = e[4];
+        ent[i][1] = *(uint32_t *)(e + 8);
+        ent[i][2] = *(uint32_t *)(e + 12);
+    }
+    for(int i = 0; i < 4; i++)
+    {
+        if(ent[i][0] == 0xee)
+        {
+            return blkGptScan(device);
+        }
+        if(ent[i][0] != 0 && ent[i][2] != 0 &&
+           blkPartAdd(device, ent[i][1], ent[i][2]) >= 0)
+        {
+            nparts++;
+        }
+    }
+    return nparts;
+}
+
+void blkPartScanAll()
+{
+    for(int device = 0; device < BLK_DEV_PART; device++)
+    {
+        if(blkDevs[device].ops != NULL)
+        {
+            blkPartScan(device);
+        }
+    }
+}
+
+#define BTEST_NBLK 9
+
+struct reqQueue btQueue;
+struct block btBlks[BTEST_NBLK];
+struct request *btLog[BTEST_NBLK];
+int btNlog;
+
+// btStart: driver of the test queue, only records the order
+//          requests are given in, they stay on the "disk"
+void btStart(struct reqQueue *q, struct request *rq)
+{
+    btLog[btNlog++] = rq;
+}
+
+// btSubmit: queue test block i as block number block
+void btSubmit(int i, sector_t block, int write)
+{
+    btBlks[i].device = 0;
+    btBlks[i].block = block;
+    btBlks[i].flags = 0;
+    blkSubmit(&btQueue, &(btBlks[i]), write);
+}
+
+void blkTest()
+{
+    blkQueueInit(&btQueue, 8, BTEST_NBLK, btStart);
+    btNlog = 0;
+    blkPlug(&btQueue);
+
+    // 1. back merge 10 <- 11, front merge 9 -> 10, then 12
+    //    fills the gap to 13 and the two requests join
+    btSubmit(0, 10, 0);
+    btSubmit(1, 11, 0);
+    btSubmit(2, 9, 0);
+    btSubmit(3, 13, 0);
+    btSubmit(4, 12, 0);
+    struct request *rq = btQueue.head;
+    int ok = (rq != NULL && rq->next == NULL && rq->block == 9 && rq->nblk == 5);
+    sector_t expect = 9;
+    for(struct block *b = (rq != NULL) ? rq->head : NULL; b != NULL; b = b->io_next)
+    {
+        ok = ok && (b->block == expect++) && (b->io_rq == rq);
+    }
+    ok = ok && (expect == 14);
+    printf("blk merge: %s\n", ok ? "ok" : "FAIL");
+
+    // 2. a write next to a read stays apart. with the head at
+    //    20, C-LOOK gives 30, 40, 41 and wraps to 2, 9
+    btSubmit(5, 30, 0);
+    btSubmit(6, 2, 0);
+    btSubmit(7, 40, 1);
+    btSubmit(8, 41, 0);
+    btQueue.device = 0;
+    btQueue.pos = 20;
+    blkUnplug(&btQueue);
+
+    sector_t order[] = {30, 40, 41, 2, 9};
+    ok = (btNlog == 5 && btQueue.head == NULL);
+    for(int i = 0; ok && i < 5; i++)
+    {
+        ok = (btLog[i]->block == order[i]);
+    }
+    printf("blk dispatch: %d requests, %s\n", btNlog, ok ? "ok" : "FAIL");
+
+    // 3. finish them all, every block valid and clean
+    for(int i = 0; i < btNlog; i++)
+    {
+        spinlockLock(&(btQueue.lock));
+        blkComplete(&btQueue, btLog[i], 0);
+        spinlockUnlock(&(btQueue.lock));
+        blkWakeup(&btQueue, btLog[i]);
+    }
+    ok = (btQueue.nactive == 0);
+    for(int i = 0; i < BTEST_NBLK; i++)
+    {
+        ok = ok && (btBlks[i].flags == B_VALID);
+    }
+    printf("blk complete: %s\n", ok ? "ok" : "FAIL");
+}
+
+struct block ptBlk;
+int ptFree[NBLKPART];
+
+// ptWrite: write ptBlk as block of device
+int ptWrite(int device, sector_t block)
+{
+    ptBlk.device = device;
+    ptBlk.block = block;
+    return blkDevWrite(&ptBlk);
+}
+
+// ptSnap: remember which partition numbers are free
+void ptSnap()
+{
+    for(int i = 0; i < NBLKPART; i++)
+    {
+        ptFree[i] = (blkDevs[BLK_DEV_PART + i].ops == NULL);
+    }
+}
+
+// ptCheck: partitions registered since ptSnap are n ones of
+//          disk at starts, of nblk blocks each
+// outputs : device number of the first one, -1 if they differ
+int ptCheck(int disk, int n, sector_t *starts, sector_t *nblk)
+{
+    int k = 0, first = -1;
+    for(int i = 0; i < NBLKPART; i++)
+    {
+        if(!ptFree[i] || blkDevs[BLK_DEV_PART + i].ops == NULL)
+        {
+            continue;
+        }
+        struct blkPart *pt = &(blkParts[i]);
+        if(k >= n || pt->parent != disk || pt->start != starts[k] || pt->nblk != nblk[k])
+        {
+            return -1;
+        }
+        if(k++ == 0)
+        {
+            first = BLK_DEV_PART + i;
+        }
+    }
+    return (k == n) ? first : -1;
+}
+
+void blkPartTest()
+{
+    int disk = rdInit(4);
+    if(disk < 0)
+    {
+        printf("[Error] blkPartTest: rdInit\n");
+        return ;
+    }
+    uint8_t *s = (uint8_t *)ptBlk.buf;
+
+    // 1. MBR of two partitions, at 4 and 16, the rest unused
+    memset(ptBlk.buf, 0, BSIZE);
+    s[446 + 4] = 0x83;
+    *(uint32_t *)(s + 446 + 8) = 4;
+    *(uint32_t *)(s + 446 + 12) = 8;
+    s[446 + 16 + 4] = 0x0c;
+    *(uint32_t *)(s + 446 + 16 + 8) = 16;
+    *(uint32_t *)(s + 446 + 16 + 12) = 8;
+    s[510] = 0x55;
+    s[511] = 0xaa;
+    ptWrite(disk, 0);
+
+    ptSnap();
+    int n = blkPartScan(disk);
+    sector_t mstart[] = {4, 16}, mnblk[] = {8, 8};
+    int part = ptCheck(disk, 2, mstart, mnblk);
+    int ok = (n == 2 && part >= 0);
+
+    // block 0 of the partition is block 4 of the disk, the
+    // block keeps its own number
+    if(ok)
+    {
+        memset(ptBlk.buf, 0x5a, BSIZE);
+        ok = (ptWrite(part, 0) == 0 && ptBlk.device == part && ptBlk.block == 0);
+        memset(ptBlk.buf, 0, BSIZE);
+        ptBlk.device = disk;
+        ptBlk.block = 4;
+        ok = ok && (blkDevRead(&ptBlk) == 0) && (s[0] == 0x5a) && (s[BSIZE - 1] == 0x5a);
+    }
+    printf("blk MBR: %d partitions, %s\n", n, ok ? "ok" : "FAIL");
+
+    // 2. protective MBR, GPT header at LBA 1, 4 entries of
+    //    128 bytes at LBA 2, the second one unused
+    memset(ptBlk.buf, 0, BSIZE);
+    s[446 + 4] = 0xee;
+    *(uint32_t *)(s + 446 + 8) = 1;
+    *(uint32_t *)(s + 446 + 12) = 31;
+    s[510] = 0x55;
+    s[511] = 0xaa;
+    ptWrite(disk, 0);
+
+    memset(ptBlk.buf, 0, BSIZE);
+    *(uint64_t *)s = GPT_SIGNATURE;
+    *(uint64_t *)(s + 72) = 2;
+    *(uint32_t *)(s + 80) = 4;
+    *(uint32_t *)(s + 84) = 128;
+    ptWrite(disk, 1);
+
+    memset(ptBlk.buf, 0, BSIZE);
+    s[0] = 0xaf;
+    *(uint64_t *)(s + 32) = 8;
+    *(uint64_t *)(s + 40) = 15;
+    s[256] = 0xaf;
+    *(uint64_t *)(s + 256 + 32) = 20;
+    *(uint64_t *)(s + 256 + 40) = 27;
+    ptWrite(disk, 2);
+
+    ptSnap();
+    n = blkPartScan(disk);
+    sector_t gstart[] = {8, 20}, gnblk[] = {8, 8};
+    ok = (n == 2 && ptCheck(disk, 2, gstart, gnblk) >= 0);
+    printf("blk GPT: %d partitions, %s\n", n, ok ? "ok" : "FAIL");
+}
@@ -0,0 +1,332 @@
+#ifndef _BLK_H
+#define _BLK_H
+
+#include "types.h"
+#include "concurrency.h"
+
+// block request queue
+// blocks are submitted to the queue of their disk, a block next
+// to a queued request joins it at the back or the front, so a
+// request is a run of consecutive blocks chained by io_next.
+// requests wait sorted by (device, block), the driver is given
+// the next one in C-LOOK order: the first at or after the end
+// of the last one, else the lowest. while the queue is plugged
+// nothing is given to the driver, submitters plug around a
+// burst so it leaves as few large sorted transfers. a driver
+// which queues commands on the disk takes up to depth requests
+
+struct block;
+struct reqQueue;
+
+// vectored block I/O
+// a bio is a run of consecutive blocks of one disk moved to or
+// from a list of memory segments instead of cache buffers. it
+// is queued as a request of its own, never merged, and the
+// driver transfers on the segments without a copy. a segment
+// is whole blocks at an even address, as DMA takes it
+
+struct bioVec
+{
+    char *page;   // memory, identity mapped
+    uint32_t off; // offset in page
+    uint32_t len; // bytes, multiple of BSIZE
+};
+
+#define BIO_NVEC    16 // segments per bio
+#define BIO_MAX_BLK 64 // blocks per bio, a request of any queue
+
+struct bio
+{
+    int device;         // device number
+    sector_t block;     // first block
+    int nblk;           // number of blocks
+    int write;          // 1-write, 0-read
+    int flags;          // B_VALID or B_ERROR once finished
+    struct request *rq; // request of the bio, waiter sleeps on it
+    int nvec;           // segments
+    struct bioVec vec[BIO_NVEC];
+};
+
+struct request
+{
+    int device;           // device number
+    sector_t block;       // first block
+    int nblk;             // number of blocks
+    int write;            // 1-write, 0-read
+    struct block *head;   // first block, the rest on io_next
+    struct block *tail;   // last block
+    struct bio *bio;      // segments instead of blocks, or NULL
+    struct request *next; // next request in queue or free list
+};
+
+#define NREQ 64 // requests per queue
+
+struct reqQueue
+{
+    spinlock_t lock;          // queue and the driver of it
+    struct request *head;     // waiting requests, sorted
+    int nactive;              // requests on the disk
+    int depth;                // max requests on the disk
+    int device;               // C-LOOK position, after the
+    sector_t pos;             // last request given to driver
+    int plugged;              // plug count
+    int maxBlk;               // max blocks per request
+    void (*start)(struct reqQueue *q, struct request *rq);
+    struct request *freeList;
+    struct request reqs[NREQ];
+};
+
+// blkQueueInit: initialize request queue of a driver
+// parameters: q-queue
+//             maxBlk-max blocks per request
+//             depth-max requests on the disk at once
+//             start-driver function which issues rq, it is
+//                   called with q->lock held
+// outputs   : void
+void blkQueueInit(struct reqQueue *q, int maxBlk, int depth,
+                  void (*start)(struct reqQueue *q, struct request *rq));
+
+// blkSubmit: queue blk for read or write, merged into a queued
+//            request if possible. no wait for the disk
+// parameters: q-queue
+//             blk-block, not in any queue
+//             write-1 write, 0 read
+// outputs   : void
+void blkSubmit(struct reqQueue *q, struct block *blk, int write);
+
+// blkSubmitAt: blkSubmit at a disk address other than the one
+//              of blk, which keeps its own, e.g. a partition's
+// parameters: q-queue
+//             blk-block, not in any queue
+//             write-1 write, 0 read
+//             device-device number of the disk
+//             block-block on the disk
+// outputs   : void
+void blkSubmitAt(struct reqQueue *q, struct block *blk, int write,
+                 int device, sector_t block);
+
+// blkRun: give next request to driver if it is idle and the
+//         queue is not plugged, with q->lock
+// parameters: q-queue
+// outputs   : void
+void blkRun(struct reqQueue *q);
+
+// blkComplete: finish a request on the disk, mark its blocks
+//              B_VALID or B_ERROR and start next one. the driver
+//              calls it with q->lock, then hands rq to blkWakeup
+//              out of interrupt context, for a bio as well
+// parameters: q-queue
+//             rq-finished request
+//             err-request failed
+// outputs   : rq, it is not free until blkWakeup
+struct request *blkComplete(struct reqQueue *q, struct request *rq, int err);
+
+// blkWakeup: wake up threads waiting on a finished request and
+//            free it
+// parameters: q-queue
+//             rq-request finished by blkComplete
+// outputs   : void
+void blkWakeup(struct reqQueue *q, struct request *rq);
+
+// blkWait: wait until blk is finished
+// parameters: q-queue
+//             blk-submitted block
+// outputs   : 0-success, -1-disk error
+int blkWait(struct reqQueue *q, struct block *blk);
+
+// blkRw: submit blocks with the queue plugged, so consecutive
+//        ones are merged, and wait for all of them
+// parameters: q-queue
+//             blks-blocks
+//             n-number of blocks
+//             write-1 write, 0 read
+// outputs   : success or not
+int blkRw(struct reqQueue *q, struct block **blks, int n, int write);
+
+// blkRwAt: blkRw with blocks moved onto a disk by an offset
+// parameters: q-queue
+//             blks-blocks
+//             n-number of blocks
+//             write-1 write, 0 read
+//             device-device number of the disk, -1 the one of
+//                    each block
+//             start-added to block numbers
+// outputs   : success or not
+int blkRwAt(struct reqQueue *q, struct block **blks, int n, int write,
+            int device, sector_t start);
+
+// bioInit: start an empty bio
+// parameters: bio-bio
+//             device-device number
+//             block-first block
+//             write-1 write, 0 read
+// outputs   : void
+void bioInit(struct bio *bio, int device, sector_t block, int write);
+
+// bioAdd: append a segment, joined to the last one if it goes on
+//         where that one ends
+// parameters: bio-bio
+//             page-memory
+//             off-offset in page
+//             len-bytes, multiple of BSIZE
+// outputs   : 0-added, -1-bad segment or bio is full
+int bioAdd(struct bio *bio, char *page, uint32_t off, uint32_t len);
+
+// blkSubmitBio: queue bio as a request of its own, no wait
+// parameters: q-queue
+//             bio-bio
+//             device-device number of the disk
+//             start-added to the block of bio
+// outputs   : 0-queued, -1-too large for the queue
+int blkSubmitBio(struct reqQueue *q, struct bio *bio, int device, sector_t start);
+
+// blkWaitBio: wait until bio is finished
+// parameters: q-queue
+//             bio-submitted bio
+// outputs   : 0-success, -1-disk error
+int blkWaitBio(struct reqQueue *q, struct bio *bio);
+
+// blkDrain: wait until the disk has no request and keep new
+//           ones from it, for a command out of the queue
+// parameters: q-queue
+// outputs   : void
+void blkDrain(struct reqQueue *q);
+
+// blkUndrain: let requests go to the disk again
+// parameters: q-queue
+// outputs   : void
+void blkUndrain(struct reqQueue *q);
+
+// blkPlug: hold requests in the queue
+// parameters: q-queue
+// outputs   : void
+void blkPlug(struct reqQueue *q);
+
+// blkUnplug: release a plug, requests go to driver when the
+//            last one is released
+// parameters: q-queue
+// outputs   : void
+void blkUnplug(struct reqQueue *q);
+
+// block device
+// a disk registered by its driver under a device number, struct
+// block carries the number. the file system moves blocks
+// through the ops and doesn't know which driver is behind.
+// device numbers: IDE 0-1, AHCI 2-5, virtio 6-7, RAM disk 8-9,
+// partitions found on them from BLK_DEV_PART
+
+struct blkDev;
+
+struct blkOps
+{
+    // rw: submit n blocks of the device and wait for them.
+    // start is added to their block numbers on the disk, it
+    // is the offset of a partition, 0 for the whole disk
+    int (*rw)(struct blkDev *bd, struct block **blks, int n, int write,
+              sector_t start);
+    // bio: move a bio and wait for it, NULL if driver can't
+    int (*bio)(struct blkDev *bd, struct bio *bio, sector_t start);
+    // flush: write the disk's volatile cache to media
+    int (*flush)(struct blkDev *bd);
+    // size: blocks on the device
+    sector_t (*size)(struct blkDev *bd);
+};
+
+struct blkDev
+{
+    char *name;
+    struct blkOps *ops;  // NULL if the number is free
+    struct reqQueue *q;  // request queue, NULL if driver has none
+    void *priv;          // driver data
+};
+
+#define NBLKDEV      32
+#define BLK_DEV_PART 10 // first partition device number
+struct blkDev blkDevs[NBLKDEV];
+
+// partition, a range of blocks of its parent disk
+struct blkPart
+{
+    int parent;     // device number of the disk
+    sector_t start; // first block on the disk
+    sector_t nblk;  // blocks
+};
+
+#define NBLKPART (NBLKDEV - BLK_DEV_PART)
+struct blkPart blkParts[NBLKPART];
+
+// blkDevRegister: register a disk under a device number
+// parameters: device-device number
+//             name-name of the disk
+//             ops-driver operations
+//             q-request queue, NULL if none
+//             priv-driver data
+// outputs   : 0-success, -1-bad or used number
+int blkDevRegister(int device, char *name, struct blkOps *ops,
+                   struct reqQueue *q, void *priv);
+
+// blkDevGet: registered disk of a device number
+// parameters: device-device number
+// outputs   : disk, NULL if there is none
+struct blkDev *blkDevGet(int device);
+
+// blkDevRw: move blocks of one disk, the one of blks[0]
+// parameters: blks-blocks
+//             n-number of blocks
+//             write-1 write, 0 read
+// outputs   : success or not
+int blkDevRw(struct block **blks, int n, int write);
+
+// blkDevRead: read a block from its disk
+// parameters: blk-read into this block
+// outputs   : success or not
+int blkDevRead(struct block *blk);
+
+// blkDevWrite: write a block to its disk
+// parameters: blk-write this block to disk
+// outputs   : success or not
+int blkDevWrite(struct block *blk);
+
+// blkDevBio: move a bio on its disk
+// parameters: bio-bio
+// outputs   : 0-success, -1-disk error or the driver has no bio,
+//             the caller goes through the cache instead
+int blkDevBio(struct bio *bio);
+
+// blkDevFlush: flush write cache of a disk
+// parameters: device-device number
+// outputs   : success or not
+int blkDevFlush(int device);
+
+// blkDevSize: size of a disk
+// parameters: device-device number
+// outputs   : blocks, 0 if there is no such disk
+sector_t blkDevSize(int device);
+
+// blkPartAdd: register a partition of a disk
+// parameters: parent-device number of the disk
+//             start-first sector on the disk
+//             nsect-sectors
+// outputs   : device number of the partition, -1 if no room
+int blkPartAdd(int parent, sector_t start, sector_t nsect);
+
+// blkPartScan: read MBR of a disk, or the GPT it protects, and
+//              register the partitions in it
+// parameters: device-device number of the disk
+// outputs   : number of partitions, -1 if disk can't be read
+int blkPartScan(int device);
+
+// blkPartScanAll: scan all registered disks for partitions
+// parameters: void
+// outputs   : void
+void blkPartScanAll();
+
+// Test: request queue test, merges and C-LOOK order of a queue
+//       whose driver only records the requests
+void blkTest();
+
+// Test: partition test, scan an MBR and a GPT written to a RAM
+//       disk and check the partitions registered from them
+void blkPartTest();
+
+#endif // _BLK_H
@@ -12,6 +12,31 @@ uint32_t xchg(uint32_t *addr, uint32_t val)
     return result;
 }
 
+uint32_t cmpxchg(uint32_t *addr, uint32_t oldval, uint32_t newval)
+{
+    uint32_t result;
+
+    asm volatile("lock; cmpxchgl %2, %1" :
+                 "=a" (result), "+m" (*addr) :
+                 "r" (newval), "0" (oldval) :
+                 "memory", "cc");
+    return result;
+}
+
+uint32_t xadd(uint32_t *addr, uint32_t val)
+{
+    asm volatile("lock; xaddl %0, %1" :
+                 "+r" (val), "+m" (*addr) :
+                 :
+                 "memory", "cc");
+    return val;
+}
+
+void cpuRelax()
+{
+    asm volatile("pause" : : : "memory");
+}
+
 void spinlockInit(spinlock_t *spl)
 {
     spl->lock = 0;
@@ -28,3 +53,79 @@ void spinlockUnlock(spinlock_t *spl)
     spl->lock = 0;
     sti();
 }
+
+uint32_t spinlockLockSave(spinlock_t *spl)
+{
+    uint32_t eflags = readEflags();
+    spinlockLock(spl);
+    return eflags;
+}
+
+void spinlockUnlockRestore(spinlock_t *spl, uint32_t eflags)
+{
+    xchg(&(spl->lock), 0);
+    if(eflags & FL_IF)
+    {
+        sti();
+    }
+}
+
+void rwspinlockInit(rwspinlock_t *rw)
+{
+    rw->lock = 0;
+}
+
+void rwspinlockRdLock(rwspinlock_t *rw)
+{
+    cli();
+    for(;;)
+    {
+        uint32_t v = rw->lock;
+        // writer holds or waits, let it go first
+        if((v & (RW_WRITER | RW_WWAIT)) == 0 &&
+           cmpxchg(&(rw->lock), v, v + 1) == v)
+        {
+            break;
+        }
+        cpuRelax();
+    }
+}
+
+void rwspinlockRdUnlock(rwspinlock_t *rw)
+{
+    xadd(&(rw->lock), (uint32_t)-1);
+    sti();
+}
+
+void rwspinlockWrLock(rwspinlock_t *rw)
+{
+    cli();
+    for(;;)
+    {
+        uint32_t v = rw->lock;
+        if((v & (RW_WRITER | RW_READERS)) == 0)
+        {
+            // take the lock, clear the waiting bit, other
+            // waiting writers set it again in their loop
+            if(cmpxchg(&(rw->lock), v, RW_WRITER) == v)
+            {
+                break;
+            }
+        }
+        else if((v & RW_WWAIT) == 0)
+        {
+            cmpxchg(&(rw->lock), v, v | RW_WWAIT);
+        }
+        cpuRelax();
+    }
+}
+
+void rwspinlockWrUnlock(rwspinlock_t *rw)
+{
+    uint32_t v;
+    do
+    {
+        v = rw->lock;
+    } while(cmpxchg(&(rw->lock), v, v & ~RW_WRITER) != v);
+    sti();
+}
@@ -10,12 +10,47 @@ struct spinlock
 
 typedef struct spinlock spinlock_t;
 
+// spinning reader-writer lock, one word:
+// bit 31-writer holds the lock, bit 30-writer waiting,
+// bit 0-29-number of readers. a waiting writer stops new
+// readers from entering (writer preference)
+#define RW_WRITER  0x80000000
+#define RW_WWAIT   0x40000000
+#define RW_READERS 0x3fffffff
+
+struct rwspinlock
+{
+    uint32_t lock;
+};
+
+typedef struct rwspinlock rwspinlock_t;
+
 // xchg: xchg in x86
 // parameters: addr-memory to swap out
 //             val-value to swap in
 // outputs   : swap out result
 uint32_t xchg(uint32_t *addr, uint32_t val);
 
+// cmpxchg: lock cmpxchg in x86, store newval into *addr
+//          only if *addr still equals oldval
+// parameters: addr-memory to compare and swap
+//             oldval-expected value
+//             newval-value to swap in
+// outputs   : value of *addr before the operation, equals
+//             oldval when the swap succeeded
+uint32_t cmpxchg(uint32_t *addr, uint32_t oldval, uint32_t newval);
+
+// xadd: lock xadd in x86, atomically add val to *addr
+// parameters: addr-memory to add to
+//             val-value to add
+// outputs   : value of *addr before the add
+uint32_t xadd(uint32_t *addr, uint32_t val);
+
+// cpuRelax: spin-wait hint (pause), for busy loops
+// parameters: void
+// outputs   : void
+void cpuRelax();
+
 // spinlockInit: initialize spinlock
 // parameters: spl-spinlock
 // outputs   : void
@@ -31,4 +66,43 @@ void spinlockLock(spinlock_t *spl);
 // outputs  : void
 void spinlockUnlock(spinlock_t *spl);
 
+// spinlockLockSave: lock spinlock, keep interrupt state
+//                   so that unlock won't enable interrupts
+//                   the caller had disabled
+// parameters: spl-spinlock
+// outputs   : eflags before lock
+uint32_t spinlockLockSave(spinlock_t *spl);
+
+// spinlockUnlockRestore: unlock spinlock, restore interrupt
+//                        state saved by spinlockLockSave
+// parameters: spl-spinlock
+//             eflags-saved eflags
+// outputs   : void
+void spinlockUnlockRestore(spinlock_t *spl, uint32_t eflags);
+
+// rwspinlockInit: initialize reader-writer spinlock
+// parameters: rw-reader-writer spinlock
+// outputs   : void
+void rwspinlockInit(rwspinlock_t *rw);
+
+// rwspinlockRdLock: lock for read, shared with other readers
+// parameters: rw-reader-writer spinlock
+// outputs   : void
+void rwspinlockRdLock(rwspinlock_t *rw);
+
+// rwspinlockRdUnlock: unlock a read lock
+// parameters: rw-reader-writer spinlock
+// outputs   : void
+void rwspinlockRdUnlock(rwspinlock_t *rw);
+
+// rwspinlockWrLock: lock for write, exclusive
+// parameters: rw-reader-writer spinlock
+// outputs   : void
+void rwspinlockWrLock(rwspinlock_t *rw);
+
+// rwspinlockWrUnlock: unlock a write lock
+// parameters: rw-reader-writer spinlock
+// outputs   : void
+void rwspinlockWrUnlock(rwspinlock_t *rw);
+
 #endif // _CONCURRENCY_H
\ No newline at end of file
@@ -0,0 +1,123 @@
+#include "cpu.h"
+#include "acpi.h"
+#include "apic.h"
+#include "idt.h"
+#include "thread.h"
+#include "timer.h"
+#include "memory.h"
+#include "util.h"
+#include "console.h"
+#include "port.h"
+
+extern char trampStart[], trampEnd[];
+
+struct cpu *mycpu()
+{
+    struct cpu *c;
+    asm volatile("movl %%gs:0, %0" : "=r"(c));
+    return c;
+}
+
+void cpuSetup(struct cpu *c, int id)
+{
+    c->self = c;
+    c->id = id;
+    c->current = NULL;
+    c->resched = 0;
+    c->pgd = kpgdir;
+    c->call = NULL;
+
+    // shared segments from the global gdt, plus a data
+    // segment covering only this struct cpu for %gs
+    memmove(c->gdt, gdt, sizeof(gdt));
+    gdeInit(&(c->gdt[SEG_KCPU]), sizeof(struct cpu) - 1, (uint32_t)c, ST_KERNEL_DATA);
+    gdtLoad(c->gdt, sizeof(c->gdt));
+    loadgs(selector(SEG_KCPU));
+}
+
+// microDelay: rough busy wait, for APIC startup sequence
+void microDelay(int us)
+{
+    for(int i = 0; i < us * 100; i++)
+    {
+        cpuRelax();
+    }
+}
+
+// lapicStartAp: INIT-SIPI-SIPI, start AP apicid at addr
+void lapicStartAp(int apicid, uint32_t addr)
+{
+    // warm reset vector (40:67) points to startup code,
+    // with CMOS shutdown code 0x0a
+    outb(0x70, 0xf);
+    outb(0x71, 0xa);
+    uint16_t *wrv = (uint16_t *)((0x40 << 4) | 0x67);
+    wrv[0] = 0;
+    wrv[1] = addr >> 4;
+
+    // INIT, assert then deassert
+    lapicWrite(LAPIC_ICRHI, apicid << 24);
+    lapicWrite(LAPIC_ICRLO, ICR_INIT | ICR_LEVEL | ICR_ASSERT);
+    microDelay(200);
+    lapicWrite(LAPIC_ICRLO, ICR_INIT | ICR_LEVEL);
+    microDelay(10000);
+
+    // STARTUP twice, vector is the page number of addr
+    for(int i = 0; i < 2; i++)
+    {
+        lapicWrite(LAPIC_ICRHI, apicid << 24);
+        lapicWrite(LAPIC_ICRLO, ICR_STARTUP | (addr >> 12));
+        microDelay(200);
+    }
+}
+
+void smpInit()
+{
+    cpus[0].apicid = lapicId();
+    cpus[0].started = 1;
+    if(!haveApic)
+    {
+        return ;
+    }
+
+    memmove((void *)TRAMPOLINE, trampStart, trampEnd - trampStart);
+
+    for(int i = 0; i < acpi.ncpu; i++)
+    {
+        if(acpi.apicIds[i] == cpus[0].apicid)
+        {
+            continue;
+        }
+
+        struct cpu *c = &(cpus[ncpu]);
+        c->apicid = acpi.apicIds[i];
+        c->id = ncpu;
+        c->started = 0;
+
+        // stack and entry for the trampoline
+        *(uint32_t *)TRAMP_STACK = (uint32_t)allocPage() + PGSIZE;
+        *(uint32_t *)TRAMP_ENTRY = (uint32_t)apMain;
+        *(uint32_t *)TRAMP_ARG = (uint32_t)c;
+
+        lapicStartAp(c->apicid, TRAMPOLINE);
+        while(!c->started)
+        {
+            cpuRelax();
+        }
+        ncpu++;
+    }
+
+    printf("[smp] %d cpus running\n", ncpu);
+}
+
+void apMain(struct cpu *c)
+{
+    cpuSetup(c, c->id);
+    idtLoad();
+    lapicInit();
+    thrCpuInit(c);
+    lapicTimerInit(SET_FREQ);
+
+    c->started = 1;
+    thrSchedStart();
+}
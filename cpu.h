@@ -0,0 +1,96 @@
+#ifndef _CPU_H
+#define _CPU_H
+
+#include "types.h"
+#include "gdt.h"
+#include "concurrency.h"
+#include "memory.h"
+
+#define NCPU 8 // max processors supported
+
+#define RQSIZE 256 // run queue capacity, >= THRQUESIZE
+#define RQ_STEAL_MAX 8 // max threads taken by one steal
+#define NPRIO 4 // thread priority levels, see thread.h
+
+#define PERCPU_SIZE 8192 // per-cpu variable area, see percpu.h
+#define CACHELINE   64
+
+// AP startup code is copied here, SIPI vector 0x07. the
+// BSP leaves arguments for the AP just below it
+#define TRAMPOLINE       0x7000
+#define TRAMP_STACK      (TRAMPOLINE - 4)  // stack top
+#define TRAMP_ENTRY      (TRAMPOLINE - 8)  // C entry, apMain
+#define TRAMP_ARG        (TRAMPOLINE - 12) // struct cpu *
+
+struct thread;
+struct context;
+struct ipiCallReq;
+
+// ready threads of one priority, FIFO
+struct rqlist
+{
+    struct thread *thrs[RQSIZE];
+    int head;             // pop here
+    int tail;             // push here, steal before it
+    int len;
+};
+
+// per-cpu run queue, a deque of ready threads for each
+// priority, the highest non-empty one runs first. the owner
+// pops at head, an idle cpu steals from tail. len is published
+// for other cpus to read without the lock, they use it to find
+// the busiest queue
+struct runqueue
+{
+    struct rqlist q[NPRIO];
+    uint32_t bitmap;      // bit p set if q[p] is not empty
+    volatile int len;     // threads in all lists
+    spinlock_t lock;
+};
+
+// per-cpu data, %gs of each cpu selects SEG_KCPU whose base
+// is its own struct cpu, so mycpu() is one load of %gs:0
+struct cpu
+{
+    struct cpu *self;            // must be first, %gs:0
+    int id;                      // index in cpus
+    int apicid;                  // local APIC id
+    volatile int started;        // AP has come up
+    struct thread *current;      // running thread
+    struct thread *scheduler;    // scheduler context
+    struct thread *idle;         // runs when run queue is empty
+    int resched;                 // yield on interrupt exit
+    struct runqueue rq;          // ready threads
+    pde_t *pgd;                  // page directory in %cr3
+    struct ipiCallReq *volatile call; // posted by ipiCall
+    gde_t gdt[GDTSIZE];          // this cpu's gdt
+    // per-cpu variables, own cache lines, must be last
+    char percpu[PERCPU_SIZE] __attribute__((aligned(CACHELINE)));
+};
+
+struct cpu cpus[NCPU];
+int ncpu;
+
+// mycpu: struct cpu of running cpu
+// parameters: void
+// outputs   : this cpu
+struct cpu *mycpu();
+
+// cpuSetup: fill struct cpu, load its gdt and %gs
+// parameters: c-cpu
+//             id-index in cpus
+// outputs   : void
+void cpuSetup(struct cpu *c, int id);
+
+// smpInit: start application processors reported by ACPI
+//          with INIT-SIPI-SIPI, wait until they run
+// parameters: void
+// outputs   : void
+void smpInit();
+
+// apMain: C entry of application processors
+// parameters: c-this cpu
+// outputs   : void, never return
+void apMain(struct cpu *c);
+
+#endif // _CPU_H
@@ -4,6 +4,7 @@
 #include "memory.h"
 #include "process.h"
 #include "thread.h"
+#include "ramdisk.h"
 
 void blockCacheInit()
 {
@@ -36,31 +37,52 @@ void blockCacheInit()
         bcache.blkHash[i].block = -1;
         bcache.blkHash[i].hash_next = NULL;
     }
+
+    spinlockInit(&(bcache.lock));
+}
+
+struct block *lookupCachedBlock(int device, int block)
+{
+    struct block *blk = rcuDereference(bcache.blkHash[BLKHASH(device, block)].hash_next);
+    while(blk != NULL && (blk->device != device || blk->block != block))
+    {
+        blk = rcuDereference(blk->hash_next);
+    }
+    return blk;
 }
 
 struct block *getCachedBlock(int device, int block)
 {
     struct block *blk;
 
-    // if block already in cache, return the reference
+    // if block already in cache, return the reference. the
+    // chain is walked without lock, the buffer may be given
+    // to another block meanwhile, so check it under the lock
+    // which guards the LRU list
     int key = BLKHASH(device, block);
-    if(bcache.blkHash[key].hash_next != NULL)
-    {
-        blk = bcache.blkHash[key].hash_next;
-        while(blk != NULL && blk->device != device &&
-              blk->block != block)
-        {
-            blk = blk->hash_next;
-        }
+    rcuReadLock();
+    blk = lookupCachedBlock(device, block);
+    rcuReadUnlock();
 
-        if(blk->device == device && blk->block == block)
+    spinlockLock(&(bcache.lock));
+    if(blk == NULL || blk->hash_prev == NULL ||
+       blk->device != device || blk->block != block)
+    {
+        blk = lookupCachedBlock(device, block);
+    }
+    if(blk != NULL)
+    {
+        // remove block from LRU list, if it is not in use
+        blk->flags = B_VALID;
+        if(blk->lru_prev != NULL)
         {
-            // remove block from LRU list
-            blk->flags = B_VALID;
             blk->lru_prev->lru_next = blk->lru_next;
             blk->lru_next->lru_prev = blk->lru_prev;
-            return blk;
+            blk->lru_prev = NULL;
+            blk->lru_next = NULL;
         }
+        spinlockUnlock(&(bcache.lock));
+        return blk;
     }
 
     // block is not in cache, replace the least recently used block
@@ -69,6 +91,7 @@ struct block *getCachedBlock(int device, int block)
     if(bcache.lruListHead->lru_next == bcache.lruListHead ||
        bcache.lruListHead->lru_next == NULL)
     {
+        spinlockUnlock(&(bcache.lock));
         printf("[Error] buffer cache: no available buffer\n");
         return NULL;
     }
@@ -76,15 +99,22 @@ struct block *getCachedBlock(int device, int block)
     blk = bcache.lruListHead->lru_next;
     bcache.lruListHead->lru_next = blk->lru_next;
     blk->lru_next->lru_prev = bcache.lruListHead;
+    blk->lru_prev = NULL;
+    blk->lru_next = NULL;
 
     blk->device = device;
     blk->block = block;
     blk->lruCnt = 0;
 
-    // add blk to hash
+    // add blk to hash, publish it after it is filled
     blk->hash_next = bcache.blkHash[key].hash_next;
     blk->hash_prev = &(bcache.blkHash[key]);
-    bcache.blkHash[key].hash_next = blk;
+    if(blk->hash_next != NULL)
+    {
+        blk->hash_next->hash_prev = blk;
+    }
+    rcuAssign(bcache.blkHash[key].hash_next, blk);
+    spinlockUnlock(&(bcache.lock));
 
     return blk;
 }
@@ -94,29 +124,18 @@ struct block *getCachedBlock(int device, int block)
 // be careful when use it.
 void relCachedBlock(struct block *blk)
 {
-    struct block *p;
-    // remove from hash
-    int key = BLKHASH(blk->device, blk->block);
-    if(bcache.blkHash[key].hash_next != NULL)
-    {
-        p = bcache.blkHash[key].hash_next;
-        while(p->hash_next != NULL && p->hash_next->device != blk->device &&
-              p->hash_next->block != blk->block)
-        {
-            p = p->hash_next;
-        }
-
-        if(p->hash_next->device == blk->device && p->hash_next->block == blk->block)
+    spinlockLock(&(bcache.lock));
+    // remove from hash, hash_next is left for readers
+    // still walking through blk
+    if(blk->hash_prev != NULL)
+    {
+        blk->hash_prev->hash_next = blk->hash_next;
+        if(blk->hash_next != NULL)
         {
-            p->hash_next = blk->hash_next;
-            if(blk->hash_next != NULL)
-            {
-                blk->hash_next->hash_prev = p;
-            }
+            blk->hash_next->hash_prev = blk->hash_prev;
         }
     }
     blk->hash_prev = NULL;
-    blk->hash_next = NULL;
     blk->flags = B_UNUSED;
 
     // add to the tail of LRU list
@@ -124,6 +143,7 @@ void relCachedBlock(struct block *blk)
     blk->lru_prev = bcache.lruListHead->lru_prev;
     bcache.lruListHead->lru_prev = blk;
     blk->lru_next = bcache.lruListHead;
+    spinlockUnlock(&(bcache.lock));
 }
 
 struct block *blockRead(int device, int block)
@@ -136,13 +156,11 @@ struct block *blockRead(int device, int block)
     }
     else
     {
-        if(hardReadWait(blk) != 0)
+        if(blkDevRead(blk) != 0)
         {
-            printf("[Error] blockRead: hardReadWait\n");
+            printf("[Error] blockRead: blkDevRead\n");
             return NULL;
         }
-
-        blk->flags = B_VALID;
     }
 
     return blk; 
@@ -153,7 +171,81 @@ int blockWrite(struct block *blk)
     struct block *cblk; 
     cblk = getCachedBlock(blk->device, blk->block);
     memmove(cblk->buf, blk->buf, BSIZE);
-    return hardWrite(cblk);
+    return blkDevWrite(cblk);
+}
+
+int blockReadRun(int device, uint32_t *blocks, int n)
+{
+    struct block *miss[NDATA];
+    int nmiss = 0;
+    int err = 0;
+    for(int i = 0; i < n; i++)
+    {
+        struct block *blk = getCachedBlock(device, blocks[i]);
+        if(blk == NULL)
+        {
+            err = -1;
+        }
+        else if(blk->flags != B_VALID)
+        {
+            miss[nmiss++] = blk;
+        }
+    }
+
+    // disk queue merges consecutive ones into one request
+    if(nmiss > 0 && blkDevRw(miss, nmiss, 0) != 0)
+    {
+        err = -1;
+    }
+    return err;
+}
+
+int blockReadDirect(int device, uint32_t *blocks, int n, char *buf)
+{
+    struct bio bio;
+    int i = 0;
+    while(i < n)
+    {
+        // 1. run of consecutive blocks not in cache
+        int j = i;
+        bioInit(&bio, device, blocks[i], 0);
+        while(j < n && (j == i || blocks[j] == blocks[j - 1] + 1))
+        {
+            rcuReadLock();
+            struct block *cb = lookupCachedBlock(device, blocks[j]);
+            rcuReadUnlock();
+            if(cb != NULL || bioAdd(&bio, buf, j * BSIZE, BSIZE) != 0)
+            {
+                break;
+            }
+            j++;
+        }
+
+        // 2. disk to buf, no copy
+        if(j > i && blkDevBio(&bio) == 0)
+        {
+            i = j;
+            continue;
+        }
+
+        // 3. through cache
+        j = (j > i) ? j : i + 1;
+        for(; i < j; i++)
+        {
+            struct block *blk = blockRead(device, blocks[i]);
+            if(blk == NULL)
+            {
+                return -1;
+            }
+            memmove(buf + i * BSIZE, blk->buf, BSIZE);
+        }
+    }
+    return 0;
+}
+
+int blockWriteRun(struct block **blks, int n)
+{
+    return blkDevRw(blks, n, 1);
 }
 
 void blockCacheTest()
@@ -164,7 +256,7 @@ void blockCacheTest()
     strncpy(b.buf, (const char *)str, strlen(str));
     printf("[Block Write] write: %s\n", b.buf);
 
-    b.device = 0;
+    b.device = fsRootDev;
     b.block = 2;
     b.flags = B_DIRTY;
     if(blockWrite(&b) != 0)
@@ -217,6 +309,13 @@ int writeSuperblock(struct superblock *sb, int device)
         return -1;
     }
 
+    // superblock is on media, not only in the disk cache
+    if(blkDevFlush(device) != 0)
+    {
+        printf("[Error] writeSuperblock: blkDevFlush\n");
+        return -1;
+    }
+
     return 0;
 }
 
@@ -231,7 +330,7 @@ void diskLayoutInit()
     sb.inodeStart = 10;
     sb.bitmapStart = 20;
     sb.dataStart = 23;
-    sb.device = 0;
+    sb.device = fsRootDev;
     writeSuperblock(&sb, sb.device);
     // if(haveDisk1)
     // {
@@ -255,7 +354,7 @@ void superblockTest()
 {
     struct superblock ws, rs;
 
-    ws.device = 0;
+    ws.device = fsRootDev;
 
     ws.nLogBlock = 30;
     ws.nInodeBlock = 32;
@@ -265,9 +364,9 @@ void superblockTest()
     ws.inodeStart = 32;
     ws.dataStart = 64;
 
-    writeSuperblock(&ws, 0);
+    writeSuperblock(&ws, fsRootDev);
 
-    readSuperblock(&rs, 0);
+    readSuperblock(&rs, fsRootDev);
     printf("[Log Start Block] %d\n", rs.logStart);
     printf("[Inode Start Block] %d\n", rs.inodeStart);
     printf("[Data Start Block] %d\n", rs.dataStart);
@@ -301,6 +400,33 @@ void inodeCacheInit()
         icache.ihash[i].ino = -1;
         icache.ihash[i].hash_next = NULL;
     }
+
+    spinlockInit(&(icache.lock));
+}
+
+struct inode *lookupCachedInode(int ino)
+{
+    struct inode *ind = rcuDereference(icache.ihash[IHASH(ino)].hash_next);
+    while(ind != NULL && ind->ino != ino)
+    {
+        ind = rcuDereference(ind->hash_next);
+    }
+    return ind;
+}
+
+// icacheGetFree: take a free inode off LRU list, with
+// icache.lock. a cached inode is never released, so the
+// list only holds ones not cached yet
+struct inode *icacheGetFree()
+{
+    struct inode *ind = icache.lruListHead->lru_next;
+    if(ind == icache.lruListHead || ind == NULL)
+    {
+        return NULL;
+    }
+    icache.lruListHead->lru_next = ind->lru_next;
+    ind->lru_next->lru_prev = icache.lruListHead;
+    return ind;
 }
 
 struct inode *getCachedInode(int ino, int device)
@@ -308,35 +434,38 @@ struct inode *getCachedInode(int ino, int device)
     struct inode *ind = NULL;
 
     int key = IHASH(ino);
-    // 1. if in cache, return directly
-    if(icache.ihash[key].hash_next != NULL)
+    // 1. if in cache, return directly, lookups take no
+    //    lock, a hashed inode stays in its chain and
+    //    in its buffer for good
+    ind = lookupCachedInode(ino);
+    if(ind != NULL)
     {
-        ind = icache.ihash[key].hash_next;
-        while(ind != NULL && ind->ino != ino)
-        {
-            ind = ind->hash_next;
-        }
+        ind->dinode.flag = I_VALID;
+        xadd((uint32_t *)&(ind->access), 1);
+        return ind;
+    }
 
-        if(ind->ino == ino)
-        {
-            ind->dinode.flag = I_VALID;
-            ind->access++;
-            return ind;
-        }
+    // 2. if not in cache, get a free inode first, look
+    //    again since another thread may have cached it
+    //    before we took the lock
+    spinlockLock(&(icache.lock));
+    ind = lookupCachedInode(ino);
+    if(ind != NULL)
+    {
+        ind->dinode.flag = I_VALID;
+        xadd((uint32_t *)&(ind->access), 1);
+        spinlockUnlock(&(icache.lock));
+        return ind;
     }
 
-    // 2. if not in cache, get a free inode first
-    if(icache.lruListHead->lru_next == icache.lruListHead ||
-       icache.lruListHead->lru_next == NULL)
+    ind = icacheGetFree();
+    if(ind == NULL)
     {
+        spinlockUnlock(&(icache.lock));
         printf("[Error] getCachedInode: no available buffer\n");
         return NULL;
     }
 
-    ind = icache.lruListHead->lru_next;
-    icache.lruListHead->lru_next = ind->lru_next;
-    ind->lru_next->lru_prev = icache.lruListHead;
-
     ind->dinode.type = I_NOTCACHE;
 
     // // 3. read superblock
@@ -356,10 +485,16 @@ struct inode *getCachedInode(int ino, int device)
     // // // 6. release block
     // // relCachedBlock(blk);
 
-    // 7. add to hash
+    // 7. add to hash, publish it after ino is set
+    ind->ino = ino;
     ind->hash_next = icache.ihash[key].hash_next;
     ind->hash_prev = &(icache.ihash[key]);
-    icache.ihash[key].hash_next = ind;
+    if(ind->hash_next != NULL)
+    {
+        ind->hash_next->hash_prev = ind;
+    }
+    rcuAssign(icache.ihash[key].hash_next, ind);
+    spinlockUnlock(&(icache.lock));
 
     return ind;   
 }
@@ -473,7 +608,7 @@ int freeInode(int device, int ino)
 
 void inodeTest()
 {
-    struct inode *ind = allocInode(0);
+    struct inode *ind = allocInode(fsRootDev);
     if(ind == NULL)
     {
         printf("[Error] inodeTest: allocInode\n");
@@ -482,7 +617,7 @@ void inodeTest()
 
     printf("[Inode Test] ino: %d\n", ind->ino);
 
-    ind = allocInode(0);
+    ind = allocInode(fsRootDev);
     if(ind == NULL)
     {
         printf("[Error] inodeTest: allocInode\n");
@@ -548,18 +683,18 @@ int freeData(int device, uint32_t addr)
 
 void dataTest()
 {
-    uint32_t addr0 = allocData(0);
+    uint32_t addr0 = allocData(fsRootDev);
     printf("[Data Test] addr0: %d\n", addr0);
-    uint32_t addr1 = allocData(0);
+    uint32_t addr1 = allocData(fsRootDev);
     printf("[Data Test] addr1: %d\n", addr1);
-    freeData(0, addr0);
-    uint32_t addr2 = allocData(0);
+    freeData(fsRootDev, addr0);
+    uint32_t addr2 = allocData(fsRootDev);
     printf("[Data Test] addr2: %d\n", addr2);
     
     uint32_t addr[10];
     for(int i = 0; i < 10; i++)
     {
-        addr[i] = allocData(0);
+        addr[i] = allocData(fsRootDev);
         printf("[Data Test] addr: %d\n", addr[i]);
     }
 }
@@ -595,6 +730,9 @@ struct inode *namei(char *path)
     struct inode *ind;
     struct dentry de;
 
+    // lookups only read directories, they share nsLock
+    thrRwlockRdLock(&(fileSys.nsLock));
+
     // 1. get current inode
     if(*path == '/')
     {
@@ -656,6 +794,7 @@ struct inode *namei(char *path)
         }
     }
 
+    thrRwlockRdUnlock(&(fileSys.nsLock));
     return ind;
 }
 
@@ -712,21 +851,25 @@ int creat(const char *path, int mode)
         pind = fileSys.cwd;
     }
 
+    thrRwlockWrLock(&(fileSys.nsLock));
     int iblk = pind->dinode.block[(pind->size) / BSIZE];
     int off = (pind->size) % BSIZE;
     pind->size += sizeof(struct dentry);
     struct block *db = blockRead(pind->device, iblk);
     if(db == NULL)
     {
+        thrRwlockWrUnlock(&(fileSys.nsLock));
         printf("[Error] creat: blockRead\n");
         return -1;
     }
     memmove(db->buf + off, &de, sizeof(struct dentry));
     if(blockWrite(db) != 0)
     {
+        thrRwlockWrUnlock(&(fileSys.nsLock));
         printf("[Error] creat: blockWrite\n");
         return -1;
     }
+    thrRwlockWrUnlock(&(fileSys.nsLock));
 
     // 4. allocate one data block, adjust when write 
     ind->dinode.block[0] = allocData(ind->device);
@@ -800,21 +943,25 @@ int mk(char *name)
     strncpy(de.name, name, strlen(name));
     pind = fileSys.cwd;
 
+    thrRwlockWrLock(&(fileSys.nsLock));
     int iblk = pind->dinode.block[pind->size / BSIZE];
     int off = (pind->size) % BSIZE;
     pind->size += sizeof(struct dentry);
     struct block *db = blockRead(pind->device, iblk);
     if(db == NULL)
     {
+        thrRwlockWrUnlock(&(fileSys.nsLock));
         printf("[Error] mk: blockRead\n");
         return -1;
     }
     memmove(db->buf + off, &de, sizeof(struct dentry));
     if(blockWrite(db) != 0)
     {
+        thrRwlockWrUnlock(&(fileSys.nsLock));
         printf("[Error] mk: blockWrite\n");
         return -1;
     }
+    thrRwlockWrUnlock(&(fileSys.nsLock));
 
     ind->dinode.block[0] = allocData(ind->device);
 
@@ -859,6 +1006,7 @@ int rm(char *path)
     }
     
     // clear dentry
+    thrRwlockWrLock(&(fileSys.nsLock));
     struct block *db;
     struct dentry de;
     for(int i = 0; i < pind->size / BSIZE; i++)
@@ -866,6 +1014,7 @@ int rm(char *path)
         db = blockRead(pind->device, pind->dinode.block[i]);
         if(db == NULL)
         {
+            thrRwlockWrUnlock(&(fileSys.nsLock));
             printf("[Error] rm: blockRead\n");
             return -1;
         }
@@ -883,6 +1032,7 @@ int rm(char *path)
     db = blockRead(pind->device, pind->dinode.block[pind->size / BSIZE]);
     if(db == NULL)
     {
+        thrRwlockWrUnlock(&(fileSys.nsLock));
         printf("[Error] rm: blockRead\n");
         return -1;
     }
@@ -897,6 +1047,7 @@ int rm(char *path)
     }
 
     found:
+    thrRwlockWrUnlock(&(fileSys.nsLock));
     ind = getCachedInode(de.ino, pind->device);
     if(ind->dinode.type == I_NOTCACHE)
     {
@@ -945,7 +1096,25 @@ int read(int fd, void *buf, size_t size)
         return -1;
     }
 
-    db = blockRead(0, ind->dinode.block[cur]);
+    // bring in the partial blocks at both ends, one disk
+    // request for each run of consecutive blocks. whole ones
+    // between them go straight into buf below
+    if(nr >= 2)
+    {
+        blockReadRun(ind->device, &(ind->dinode.block[cur]), 1);
+        blockReadRun(ind->device, &(ind->dinode.block[cur + nr]), 1);
+    }
+    else
+    {
+        blockReadRun(ind->device, &(ind->dinode.block[cur]), nr + 1);
+    }
+
+    db = blockRead(ind->device, ind->dinode.block[cur]);
+    if(db == NULL)
+    {
+        printf("[Error] read: blockRead\n");
+        return -1;
+    }
     if(size > BSIZE - off)
     {
         memmove(pb, db->buf + off, BSIZE - off);
@@ -955,16 +1124,24 @@ int read(int fd, void *buf, size_t size)
         memmove(pb, db->buf + off, size);
     }
     pb += (size > BSIZE - off ? BSIZE - off : size);
-    for(int i = 1; i < nr; i ++)
+    if(nr >= 2)
     {
-        db = blockRead(0, ind->dinode.block[cur + i]);
-        memmove(pb, db->buf, BSIZE);
-        pb += BSIZE;
+        if(blockReadDirect(ind->device, &(ind->dinode.block[cur + 1]), nr - 1, pb) != 0)
+        {
+            printf("[Error] read: blockReadDirect\n");
+            return -1;
+        }
+        pb += (nr - 1) * BSIZE;
     }
 
     if(nr >= 1)
     {
-        db = blockRead(0, ind->dinode.block[cur + nr]);
+        db = blockRead(ind->device, ind->dinode.block[cur + nr]);
+        if(db == NULL)
+        {
+            printf("[Error] read: blockRead\n");
+            return -1;
+        }
         memmove(pb, db->buf, (size - (BSIZE - off)) % BSIZE);
         pb += (size - (BSIZE - off) % BSIZE);
     }
@@ -1001,11 +1178,15 @@ int write(int fd, void *buf, size_t size)
     // allocate new data block
     for(int i = 1; i <= na; i++)
     {
-        ind->dinode.block[cur + i] = allocData(0);
+        ind->dinode.block[cur + i] = allocData(ind->device);
     }
 
-    // fill blocks
-    db = blockRead(0, ind->dinode.block[cur]);
+    // fill blocks, missing ones are read in first. all of
+    // them go to disk at last, one request for each run of
+    // consecutive blocks
+    struct block *wb[NDATA];
+    blockReadRun(ind->device, &(ind->dinode.block[cur]), na + 1);
+    db = blockRead(ind->device, ind->dinode.block[cur]);
     if(size > BSIZE - off)
     {
         memmove(db->buf + off, pb, BSIZE - off);
@@ -1014,23 +1195,24 @@ int write(int fd, void *buf, size_t size)
     {
         memmove(db->buf + off, pb, size);
     }
-    blockWrite(db);
+    wb[0] = db;
     pb += (size > BSIZE - off ? BSIZE - off : size);
     for(int i = 1; i < na; i++)
     {
-        db = blockRead(0, ind->dinode.block[cur + i]);
+        db = blockRead(ind->device, ind->dinode.block[cur + i]);
         memmove(db->buf, pb, BSIZE);
         pb += BSIZE;
-        blockWrite(db);
+        wb[i] = db;
     }
 
     if(na >= 1)
     {
-        db = blockRead(0, ind->dinode.block[cur + na]);
+        db = blockRead(ind->device, ind->dinode.block[cur + na]);
         memmove(db->buf, pb, (size - (BSIZE - off)) % BSIZE);
         pb += (size - (BSIZE - off)) % BSIZE;
-        blockWrite(db);
+        wb[na] = db;
     }
+    blockWriteRun(wb, na + 1);
 
     // adjust inode's size
     // in fact write may be failed, the return size 
@@ -1150,10 +1332,17 @@ void fileTest()
     // TODO: cat
 }
 
-void fsInit()
+void fsInit(int rootDev)
 {
-    // 1. hard driver
+    // 1. hard driver, partitions on the disks
     hardDriverInit();
+    blkPartScanAll();
+    fsRootDev = rootDev;
+    if(blkDevGet(rootDev) == NULL)
+    {
+        printf("[Error] fsInit: no disk %d for root\n", rootDev);
+        return ;
+    }
 
     // 2. caches
     blockCacheInit();
@@ -1162,19 +1351,21 @@ void fsInit()
     diskLayoutInit();
 
     // initialize root
-    fileSys.root = allocInode(0);
-    (fileSys.root)->dinode.block[0] = allocData(0);
+    fileSys.root = allocInode(fsRootDev);
+    (fileSys.root)->dinode.block[0] = allocData(fsRootDev);
     fileSys.cwd = fileSys.root;
     char rname[] = "root/";
     strncpy(fileSys.cwd_name, rname, strlen(rname));
     fileSys.ofTbl.cnt = 0;
     fileSys.ofTbl.max_fd = 0;
+    thrRwlockInit(&(fileSys.nsLock));
 
     //hardTest();
     //superblockTest();
     //blockCacheTest();
     //dataTest();
     //inodeTest();
+    //rdTest();
     fileTest();
 }
 
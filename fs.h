@@ -3,6 +3,8 @@
 
 #include "types.h"
 #include "ide.h"
+#include "thread.h"
+#include "rcu.h"
 
 // buffer cache
 // the kernel attempts to minimize the frequency of disk access by keeping
@@ -16,12 +18,14 @@ struct block_cache
     struct block buf[BCACHE_SIZE];
     struct block *lruListHead;
     struct block blkHash[BLK_HASH_SIZE];
+    spinlock_t lock; // hash/lru changes, hash lookups run under rcu
 };
 
 struct block_cache bcache;
 
-//#define BLKHASH(dev, blk) (((dev) << 3) | ((blk) * (SECSIZE / BSIZE)) % BLK_HASH_SIZE)
-#define BLKHASH(dev, blk) ((blk) * (SECSIZE / BSIZE) % BLK_HASH_SIZE)
+// device is hashed too, the same block of two disks or
+// partitions doesn't share a chain
+#define BLKHASH(dev, blk) (((uint32_t)(dev) * 31 + (uint32_t)(blk) * (SECSIZE / BSIZE)) % BLK_HASH_SIZE)
 
 // blockCacheInit: initialize block cache
 // parameters: void
@@ -37,6 +41,13 @@ void blockCacheInit();
 // outputs:    block buffer
 struct block *getCachedBlock(int device, int block);
 
+// lookupCachedBlock: search block hash only, caller should be
+//                    in rcu read section or hold bcache.lock
+// parameters: device-device number
+//             block-block number
+// outputs   : cached block, or NULL if not in cache
+struct block *lookupCachedBlock(int device, int block);
+
 // relCachedBlock: release a cached block
 // parameters: blk-cached block ptr to release
 // outputs   : void
@@ -53,6 +64,33 @@ struct block *blockRead(int device, int block);
 // outputs   : write state
 int blockWrite(struct block *blk);
 
+// blockReadRun: bring blocks into cache, submitted together so
+//               consecutive ones are read by one request
+// parameters: device-device number
+//             blocks-block numbers
+//             n-number of blocks, no more than NDATA
+// outputs   : read state
+int blockReadRun(int device, uint32_t *blocks, int n);
+
+// blockReadDirect: read whole blocks straight into memory, a
+//                  bio for each run of consecutive blocks not in
+//                  cache. cached ones, which may be newer than
+//                  disk, and runs the disk can't take as bio are
+//                  copied from cache
+// parameters: device-device number
+//             blocks-block numbers
+//             n-number of blocks
+//             buf-memory of n blocks
+// outputs   : read state
+int blockReadDirect(int device, uint32_t *blocks, int n, char *buf);
+
+// blockWriteRun: write cached blocks to disk, submitted together
+//                like blockReadRun
+// parameters: blks-cached blocks
+//             n-number of blocks
+// outputs   : write state
+int blockWriteRun(struct block **blks, int n);
+
 // Test: buffer cache test
 void blockCacheTest();
 
@@ -123,11 +161,18 @@ struct inode
 #define IPB (BSIZE / (sizeof(struct diskInode)))
 #define IHASH(ino) ((ino) % (IHASHSIZE))
 
+// inode cache
+// a fixed pool of IBUFSIZE inodes. nothing releases a cached
+// inode, there is no iput, so once an inode is hashed it keeps
+// its buffer until reboot and a file system can't use more
+// than IBUFSIZE different inodes
+
 struct inode_cache
 {
     struct inode ibuf[IBUFSIZE];
     struct inode *lruListHead;
     struct inode ihash[IHASHSIZE];
+    spinlock_t lock; // hash/lru changes, lookups take no lock
 };
 
 struct inode_cache icache;
@@ -160,8 +205,14 @@ void inodeCacheInit();
 // getCachedInode: get cached inode, if not in cache,
 //                 return a free inode buffer
 // parameters: ino-inode number
-// outputs   : inode
+// outputs   : inode, NULL when all IBUFSIZE are cached
 struct inode *getCachedInode(int ino, int device);
+
+// lookupCachedInode: search inode hash only, no lock needed,
+//                    cached inodes are never unhashed
+// parameters: ino-inode number
+// outputs   : cached inode, or NULL if not in cache
+struct inode *lookupCachedInode(int ino);
 // getInode: not used
 struct inode *getInode(int ino, int device);
 
@@ -312,20 +363,26 @@ int rm(char *path);
 // output    : success or not
 int cat(const char *path);
 
+#define FS_ROOT_DEV 0 // default root device, first IDE disk
+int fsRootDev;        // device of root file system
+
 struct fs
 {
     char cwd_name[NAMELEN];
     struct inode *cwd;
     struct inode *root;
     struct openFile ofTbl;
+    rwlock_t nsLock; // namespace: namei reads, dentry changes write
 };
 
 struct fs fileSys;
 
-// fsInit: initialize file system
-// parameters: void
+// fsInit: initialize file system, make a new one on rootDev.
+//         e.g. on a RAM disk of rdInit, the cache and the file
+//         system then run on memory
+// parameters: rootDev-device of root file system
 // outputs   : void
-void fsInit();
+void fsInit(int rootDev);
 void fsLoad();
 
 #endif // _FS_H
\ No newline at end of file
@@ -35,14 +35,24 @@ void gdtInit()
     gdeInit(&(gdt[SEG_USER_CODE]), 0xffffffff, 0, ST_USER_CODE);
     gdeInit(&(gdt[SEG_USER_DATA]), 0xffffffff, 0, ST_USER_DATA);
 
+    gdtLoad(gdt, sizeof(gdt));
+}
+
+void gdtLoad(gde_t *table, int size)
+{
     uint16_t gdtr[3];
-    gdtr[0] = sizeof(gdt) - 1;
-    gdtr[1] = (uint32_t)gdt;
-    gdtr[2] = ((uint32_t)gdt) >> 16;
+    gdtr[0] = size - 1;
+    gdtr[1] = (uint32_t)table;
+    gdtr[2] = ((uint32_t)table) >> 16;
 
     asm volatile("lgdt (%0)" : : "r"(gdtr));
 }
 
+void loadgs(uint16_t sel)
+{
+    asm volatile("movw %0, %%gs" : : "r"(sel));
+}
+
 uint16_t selector(uint16_t index)
 {
     return (index << 3);
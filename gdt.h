@@ -10,10 +10,11 @@ enum SEG
     SEG_KERNEL_DATA,
     SEG_USER_CODE,
     SEG_USER_DATA,
-    SEG_GLOBL_TSS
+    SEG_GLOBL_TSS,
+    SEG_KCPU        // per-cpu data, loaded in %gs
 };
 
-#define GDTSIZE 6
+#define GDTSIZE 7
 
 #define ST_KERNEL_CODE 0X9a
 #define ST_KERNEL_DATA 0x92
@@ -46,6 +47,17 @@ void gdeInit(gde_t *gd, uint32_t limit, uint32_t base, uint8_t privilege);
 // outputs   : void
 void gdtInit();
 
+// gdtLoad: load a global descriptor table
+// parameters: table-descriptor table
+//             size-table size in bytes
+// outputs   : void
+void gdtLoad(gde_t *table, int size);
+
+// loadgs: load %gs segment register
+// parameters: sel-segment selector
+// outputs   : void
+void loadgs(uint16_t sel);
+
 // selector: transfer global descriptor table index into segment selector
 // parameters: index-global descriptor table index
 uint16_t selector(uint16_t index);
@@ -1,5 +1,10 @@
 #include "ide.h"
 #include "thread.h"
+#include "softirq.h"
+#include "port.h"
+#include "console.h"
+#include "pci.h"
+#include "memory.h"
 
 extern havedisk1 = 0;
 
@@ -51,25 +56,76 @@ int hardDriverInit()
     outb(IDE_DEVICE_PORT, 0xa0);
     outb(IDE_CTL_PORT, 0);
 
-    outb(IDE_DEVICE_PORT, 0xa0);
+    if(ideIdentify(0) != 0)
+    {
+        return -1;
+    }
+    haveDisk1 = (ideIdentify(1) == 0);
+
+    // initialize request queue
+    blkQueueInit(&ideQueue, IDE_MAX_BLK, 1, ideStart);
+    blkDevRegister(0, "hda", &ideOps, &ideQueue, (void *)0);
+    if(haveDisk1)
+    {
+        blkDevRegister(1, "hdb", &ideOps, &ideQueue, (void *)1);
+    }
+    ringInit(&ideDone, ideDoneSlots, IDE_NDONE, RING_SP_ENQ | RING_SC_DEQ);
+
+    ideDmaInit();
+
+    // completion comes by IRQ 14
+    bhRegister(IV_IDE, hardBottomHalf);
+    registerIrqHandler(IV_IDE, hardInterruptHandler, NULL);
+    irqEnable(IRQ_IDE);
+
+    //puts("[hard disk] hard driver runs\n");
+
+    return 0;
+}
+
+// ideWait: wait until controller is not busy, with ideQueue.lock
+int ideWait()
+{
+    uint8_t state;
+    while(((state = inb(IDE_CMD_PORT)) & (IDE_ST_BSY | IDE_ST_DRDY)) != IDE_ST_DRDY)
+    {
+        if(state & IDE_ST_ERR)
+        {
+            return -1;
+        }
+    }
+    return (state & (IDE_ST_DF | IDE_ST_ERR)) ? -1 : 0;
+}
+
+int ideIdentify(int dev)
+{
+    struct ideDisk *d = &(ideDisks[dev]);
+    d->present = 0;
+
+    outb(IDE_DEVICE_PORT, 0xa0 | (dev << 4));
     uint8_t state = inb(IDE_CMD_PORT);
     if(state == 0xff)
     {
-        printf("[Error] hard disk not exits\n");
+        if(dev == 0)
+        {
+            printf("[Error] hard disk not exits\n");
+        }
         return -1;
     }
 
-    outb(IDE_DEVICE_PORT, 0xa0);
     outb(IDE_SECNUM_PORT, 0);
     outb(IDE_SECNO0_PORT, 0);
     outb(IDE_SECNO8_PORT, 0);
     outb(IDE_SECNO16_PORT, 0);
-    outb(IDE_CMD_PORT, 0xec); // identify
+    outb(IDE_CMD_PORT, IDE_CMD_IDENTIFY);
 
     state = inb(IDE_CMD_PORT);
     if(state == 0x00)
     {
-        printf("[Error] hard disk inaccessible\n");
+        if(dev == 0)
+        {
+            printf("[Error] hard disk inaccessible\n");
+        }
         return -1;
     }
 
@@ -84,63 +140,385 @@ int hardDriverInit()
         printf("[Error] hard disk error\n");
         return -1;
     }
+    insl(IDE_DATA_PORT, d->ident, sizeof(d->ident) / 4);
 
-    // initialize wait queue
-    blkWaitQueue->lru_prev = blkWaitQueue;
-    blkWaitQueue->lru_next = blkWaitQueue;
-
-    //puts("[hard disk] hard driver runs\n");
+    // word 83 bit 10: LBA48, size in words 100-103, else
+    // LBA28 size in words 60-61
+    d->lba48 = (d->ident[83] & (1 << 10)) != 0;
+    if(d->lba48)
+    {
+        d->nsect = (sector_t)d->ident[100] | ((sector_t)d->ident[101] << 16) |
+                   ((sector_t)d->ident[102] << 32) | ((sector_t)d->ident[103] << 48);
+    }
+    else
+    {
+        d->nsect = (sector_t)d->ident[60] | ((sector_t)d->ident[61] << 16);
+    }
+    d->present = 1;
+    ideSetMult(dev);
 
+    printf("[harddisk] disk %d: %d MB, LBA%d\n", dev,
+           (int)(d->nsect >> 11), d->lba48 ? 48 : 28);
     return 0;
 }
 
-void hardRead(struct block *blk)
+int ideSetMult(int dev)
 {
+    struct ideDisk *d = &(ideDisks[dev]);
+    d->mult = 1;
+    int max = d->ident[47] & 0xff;
+    if(max <= 1)
+    {
+        return -1;
+    }
 
-    // if(testIdeState() == -1)
-    // {
-    //     return -1;
-    // }
+    outb(IDE_DEVICE_PORT, 0xe0 | (dev << 4));
+    outb(IDE_SECNUM_PORT, max);
+    outb(IDE_CMD_PORT, IDE_CMD_SETMULT);
+    if(ideWait() != 0)
+    {
+        return -1;
+    }
+    d->mult = max;
+    return 0;
+}
 
-    // 1. generate interrupt
-    outb(IDE_CTL_PORT, 0);
+int ideSetLba(int dev, sector_t sector, int nsect)
+{
+    if(ideDisks[dev].lba48 && sector + nsect > IDE_LBA28_MAX)
+    {
+        // previous content of each register first, it is
+        // the high byte
+        outb(IDE_DEVICE_PORT, 0x40 | (dev << 4));
+        outb(IDE_SECNUM_PORT, (nsect >> 8) & 0xff);
+        outb(IDE_SECNO0_PORT, (sector >> 24) & 0xff);
+        outb(IDE_SECNO8_PORT, (sector >> 32) & 0xff);
+        outb(IDE_SECNO16_PORT, (sector >> 40) & 0xff);
+        outb(IDE_SECNUM_PORT, nsect & 0xff);
+        outb(IDE_SECNO0_PORT, sector & 0xff);
+        outb(IDE_SECNO8_PORT, (sector >> 8) & 0xff);
+        outb(IDE_SECNO16_PORT, (sector >> 16) & 0xff);
+        return 1;
+    }
 
-    // 2. write LBA
-    int sector = (blk->block) * SEC_PER_BLK;
-    outb(IDE_SECNUM_PORT, SEC_PER_BLK);
+    outb(IDE_SECNUM_PORT, nsect & 0xff);
     outb(IDE_SECNO0_PORT, sector & 0xff);
     outb(IDE_SECNO8_PORT, (sector >> 8) & 0xff);
     outb(IDE_SECNO16_PORT, (sector >> 16) & 0xff);
-    outb(IDE_DEVICE_PORT, 0xe0 | ((blk->device & 1) << 4) | ((sector >> 24) & 0x0f));
+    outb(IDE_DEVICE_PORT, 0xe0 | (dev << 4) | ((sector >> 24) & 0x0f));
+    return 0;
+}
+
+int ideDmaInit()
+{
+    bmide = 0;
+    struct pciDev *d = pciFindClass(PCI_CLASS_STORAGE, PCI_SUB_IDE, 0);
+    // prog if bit 7: bus master capable
+    if(d == NULL || !(d->progif & 0x80) || !(d->bar[4] & PCI_BAR_IO))
+    {
+        printf("[harddisk] no bus master IDE, use PIO\n");
+        return -1;
+    }
+
+    pciEnable(d);
+    bmide = d->bar[4] & ~0x3;
+    printf("[harddisk] bus master IDE at %x\n", bmide);
+    return 0;
+}
+
+int idePrdBuild(int n, void *buf, uint32_t len)
+{
+    // kernel memory is identity mapped, a page is physically
+    // contiguous, so a PRD never crosses a page (or 64KB)
+    uint32_t pa = (uint32_t)buf;
+    while(len > 0)
+    {
+        if(n == IDE_NPRD)
+        {
+            return -1;
+        }
+        uint32_t chunk = PGUPBOUND(pa + 1) - pa;
+        if(chunk > len)
+        {
+            chunk = len;
+        }
+        idePrdt[n].addr = pa;
+        idePrdt[n].len = chunk;
+        idePrdt[n].flags = 0;
+        n++;
+        pa += chunk;
+        len -= chunk;
+    }
+    return n;
+}
+
+// ideDmaStart: set up bus master for rq, with ideQueue.lock
+int ideDmaStart(struct request *rq)
+{
+    int n = 0;
+    if(rq->bio != NULL)
+    {
+        // straight on the segments of the bio
+        for(int i = 0; i < rq->bio->nvec && n >= 0; i++)
+        {
+            struct bioVec *v = &(rq->bio->vec[i]);
+            n = idePrdBuild(n, v->page + v->off, v->len);
+        }
+    }
+    else
+    {
+        for(struct block *b = rq->head; b != NULL && n >= 0; b = b->io_next)
+        {
+            n = idePrdBuild(n, b->buf, BSIZE);
+        }
+    }
+    if(n <= 0)
+    {
+        return -1;
+    }
+    idePrdt[n - 1].flags = PRD_EOT;
+
+    outl(bmide + BM_PRDT, (uint32_t)idePrdt);
+    outb(bmide + BM_STATUS, BM_ST_ERR | BM_ST_INTR);
+    outb(bmide + BM_CMD, rq->write ? 0 : BM_CMD_READ);
+    return 0;
+}
+
+void ideXfer(int out)
+{
+    int n = ideXferLeft < ideXferChunk ? ideXferLeft : ideXferChunk;
+    for(int i = 0; i < n; i++)
+    {
+        char *p;
+        if(ideActive->bio != NULL)
+        {
+            p = ideXferVec->page + ideXferVec->off + ideXferOff;
+            ideXferOff += SECSIZE;
+            if(ideXferOff == ideXferVec->len)
+            {
+                ideXferOff = 0;
+                ideXferVec++;
+            }
+        }
+        else
+        {
+            p = ideXferBlk->buf + ideXferSec * SECSIZE;
+            if(++ideXferSec == SEC_PER_BLK)
+            {
+                ideXferSec = 0;
+                ideXferBlk = ideXferBlk->io_next;
+            }
+        }
+
+        if(out)
+        {
+            outsl(IDE_DATA_PORT, p, SECSIZE / 4);
+        }
+        else
+        {
+            insl(IDE_DATA_PORT, p, SECSIZE / 4);
+        }
+    }
+    ideXferLeft -= n;
+}
+
+void ideStart(struct reqQueue *q, struct request *rq)
+{
+    int nsect = rq->nblk * SEC_PER_BLK;
+    ideActive = rq;
+
+    ideWait();
+
+    // 1. generate interrupt
+    outb(IDE_CTL_PORT, 0);
+
+    // 2. write LBA and sector count, 256 is written as 0
+    struct ideDisk *d = &(ideDisks[rq->device & 1]);
+    int ext = ideSetLba(rq->device & 1, rq->block * SEC_PER_BLK, nsect);
+
+    // 3. with DMA the controller moves data by itself and
+    //    interrupts once at the end
+    if(bmide != 0 && ideDmaStart(rq) == 0)
+    {
+        if(ext)
+        {
+            outb(IDE_CMD_PORT, rq->write ? IDE_CMD_W_DMA_EXT : IDE_CMD_R_DMA_EXT);
+        }
+        else
+        {
+            outb(IDE_CMD_PORT, rq->write ? IDE_CMD_W_DMA : IDE_CMD_R_DMA);
+        }
+        outb(bmide + BM_CMD, inb(bmide + BM_CMD) | BM_CMD_START);
+        return ;
+    }
 
-    // 3. add blk to tail of wait queue
-    if(blkWaitQueue->lru_prev == blkWaitQueue)
+    // 4. tell ide to read or write, there is an interrupt
+    //    for each DRQ block, d->mult sectors in multiple
+    //    mode. data of the first write block goes now
+    int multi = (nsect > 1 && d->mult > 1);
+    ideXferBlk = rq->head;
+    ideXferSec = 0;
+    ideXferVec = (rq->bio != NULL) ? rq->bio->vec : NULL;
+    ideXferOff = 0;
+    ideXferLeft = nsect;
+    ideXferChunk = multi ? d->mult : 1;
+    if(rq->write)
     {
-        blkWaitQueue->lru_next = blk;
-        blkWaitQueue->lru_prev = blk;
-        blk->lru_next = blkWaitQueue;
-        blk->lru_prev = blkWaitQueue;
+        if(ext)
+        {
+            outb(IDE_CMD_PORT, multi ? IDE_CMD_MW_PIO_EXT : IDE_CMD_W_PIO_EXT);
+        }
+        else
+        {
+            outb(IDE_CMD_PORT, multi ? IDE_CMD_MW_PIO : IDE_CMD_W_PIO);
+        }
+        ideWait();
+        ideXfer(1);
     }
     else
     {
-        blk->lru_prev = blkWaitQueue->lru_prev;
-        blkWaitQueue->lru_prev->lru_next = blk;
-        blkWaitQueue->lru_prev = blk;
-        blk->lru_next = blkWaitQueue;
+        if(ext)
+        {
+            outb(IDE_CMD_PORT, multi ? IDE_CMD_MR_PIO_EXT : IDE_CMD_R_PIO_EXT);
+        }
+        else
+        {
+            outb(IDE_CMD_PORT, multi ? IDE_CMD_MR_PIO : IDE_CMD_R_PIO);
+        }
+    }
+}
+
+int ideRw(struct blkDev *bd, struct block **blks, int n, int write, sector_t start)
+{
+    return blkRwAt(&ideQueue, blks, n, write, (int)bd->priv, start);
+}
+
+int ideBio(struct blkDev *bd, struct bio *bio, sector_t start)
+{
+    if(blkSubmitBio(&ideQueue, bio, (int)bd->priv, start) != 0)
+    {
+        return -1;
     }
+    return blkWaitBio(&ideQueue, bio);
+}
+
+int ideFlush(struct blkDev *bd)
+{
+    int dev = (int)bd->priv;
+    blkDrain(&ideQueue);
+
+    // the interrupt handler sees no active request and leaves
+    // the completion to us
+    uint32_t eflags = spinlockLockSave(&(ideQueue.lock));
+    outb(IDE_DEVICE_PORT, 0xe0 | (dev << 4));
+    outb(IDE_CMD_PORT, ideDisks[dev].lba48 ? IDE_CMD_FLUSH_EXT : IDE_CMD_FLUSH);
+    int err = ideWait();
+    spinlockUnlockRestore(&(ideQueue.lock), eflags);
+
+    blkUndrain(&ideQueue);
+    return err;
+}
+
+sector_t ideSize(struct blkDev *bd)
+{
+    return ideDisks[(int)bd->priv].nsect / SEC_PER_BLK;
+}
+
+struct blkOps ideOps = {ideRw, ideBio, ideFlush, ideSize};
 
-    // 4. tell ide to read
-    outb(IDE_CMD_PORT, IDE_CMD_R_PIO);
+int hardReadMulti(struct block **blks, int n)
+{
+    return blkRw(&ideQueue, blks, n, 0);
+}
 
-    // 5. block current thread
-    thrCondWait(blk, &thrque_lock);
+int hardWriteMulti(struct block **blks, int n)
+{
+    return blkRw(&ideQueue, blks, n, 1);
 }
 
-void hardInterruptHandler()
+int hardRead(struct block *blk)
 {
-    // 1. get front block from block wait queue
-    // 2. read data from disk
-    // 3. wake up threads who sleep on this block
+    blkSubmit(&ideQueue, blk, 0);
+    return blkWait(&ideQueue, blk);
+}
+
+void hardInterruptHandler(struct trapframe *tf, void *ctx)
+{
+    uint32_t eflags = spinlockLockSave(&(ideQueue.lock));
+
+    // 1. get active request, nothing on the disk means the
+    //    interrupt is not ours
+    struct request *rq = ideActive;
+    if(rq == NULL)
+    {
+        spinlockUnlockRestore(&(ideQueue.lock), eflags);
+        return ;
+    }
+
+    // 2. stop bus master if it did the transfer, else
+    //    read data from disk. status read also acks it
+    uint8_t bmst = 0;
+    if(bmide != 0 && (inb(bmide + BM_CMD) & BM_CMD_START))
+    {
+        bmst = inb(bmide + BM_STATUS);
+        if(!(bmst & BM_ST_INTR))
+        {
+            // shared line, not from our disk
+            spinlockUnlockRestore(&(ideQueue.lock), eflags);
+            return ;
+        }
+        outb(bmide + BM_CMD, 0);
+        outb(bmide + BM_STATUS, BM_ST_ERR | BM_ST_INTR);
+    }
+
+    int err = (ideWait() != 0 || (bmst & BM_ST_ERR));
+    if(!err && bmst == 0)
+    {
+        // PIO, one DRQ block per interrupt. read data is
+        // ready now, a write interrupt asks for next block
+        if(!rq->write)
+        {
+            ideXfer(0);
+        }
+        if(ideXferLeft > 0)
+        {
+            if(rq->write)
+            {
+                ideXfer(1);
+            }
+            spinlockUnlockRestore(&(ideQueue.lock), eflags);
+            return ;
+        }
+    }
+
+    // 3. mark blocks and keep the disk busy with next request
+    ideActive = NULL;
+    blkComplete(&ideQueue, rq, err);
+    spinlockUnlockRestore(&(ideQueue.lock), eflags);
+
+    // 4. wake up threads who sleep on the request, in
+    //    bottom half
+    if(ringEnqueue(&ideDone, rq) == 0)
+    {
+        bhRaise(IV_IDE);
+    }
+    else
+    {
+        blkWakeup(&ideQueue, rq);
+    }
+}
+
+void hardBottomHalf()
+{
+    void *done[8];
+    int n;
+    while((n = ringDequeueBurst(&ideDone, done, 8)) > 0)
+    {
+        for(int i = 0; i < n; i++)
+        {
+            blkWakeup(&ideQueue, done[i]);
+        }
+    }
 }
 
 int hardReadWait(struct block *blk)
@@ -154,15 +532,10 @@ int hardReadWait(struct block *blk)
     outb(IDE_CTL_PORT, 0);
 
     // 2. write LBA
-    int sector = (blk->block) * SEC_PER_BLK;
-    outb(IDE_SECNUM_PORT, SEC_PER_BLK);
-    outb(IDE_SECNO0_PORT, sector & 0xff);
-    outb(IDE_SECNO8_PORT, (sector >> 8) & 0xff);
-    outb(IDE_SECNO16_PORT, (sector >> 16) & 0xff);
-    outb(IDE_DEVICE_PORT, 0xe0 | ((blk->device & 1) << 4) | ((sector >> 24) & 0x0f));
+    int ext = ideSetLba(blk->device & 1, blk->block * SEC_PER_BLK, SEC_PER_BLK);
 
     // 3. tell ide to read
-    outb(IDE_CMD_PORT, IDE_CMD_R_PIO);
+    outb(IDE_CMD_PORT, ext ? IDE_CMD_R_PIO_EXT : IDE_CMD_R_PIO);
 
     // 4. wait to read
     uint8_t state = inb(IDE_CMD_PORT);
@@ -187,33 +560,8 @@ int hardReadWait(struct block *blk)
 
 int hardWrite(struct block *blk)
 {
-
-    // if(testIdeState() == -1)
-    // {
-    //     return -1;
-    // }
-
-    // 1. generate interrupt
-    outb(IDE_CTL_PORT, 0);
-
-    // 2. wirte LBA
-    int sector = (blk->block) * SEC_PER_BLK;
-    outb(IDE_SECNUM_PORT, BSIZE/SECSIZE);
-    outb(IDE_SECNO0_PORT, sector & 0xff);
-    outb(IDE_SECNO8_PORT, (sector >> 8) & 0xff);
-    outb(IDE_SECNO16_PORT, (sector >> 16) & 0xff);
-    outb(IDE_DEVICE_PORT, 0xe0 | ((blk->device & 1) << 4) | ((sector >> 24) & 0x0f));
-
-    // 3. tell ide it's a pio write
-    outb(IDE_CMD_PORT, IDE_CMD_W_PIO);
-
-    // 4. write to disk
-    outsl(IDE_DATA_PORT, blk->buf, BSIZE / 4);
-
-    //outb(IDE_CMD_PORT, 0xe7);
-    blk->flags = B_VALID;
-    
-    return 0;
+    blkSubmit(&ideQueue, blk, 1);
+    return blkWait(&ideQueue, blk);
 }
 
 void hardTest()
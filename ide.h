@@ -3,6 +3,9 @@
 
 #include "util.h"
 #include "concurrency.h"
+#include "idt.h"
+#include "ring.h"
+#include "blk.h"
 
 #define IDE_DATA_PORT    0x1f0 
 #define IDE_SECNUM_PORT  0x1f2
@@ -41,6 +44,52 @@
 #define IDE_CMD_MW_PIO 0xc5 // pio multiple write
 #define IDE_CMD_R_DMA  0xc8 // DMA read
 #define IDE_CMD_W_DMA  0xca // DMA write
+#define IDE_CMD_SETMULT  0xc6 // set multiple mode
+#define IDE_CMD_IDENTIFY 0xec // identify device
+#define IDE_CMD_FLUSH    0xe7 // flush write cache
+
+// LBA48 variants, 48-bit address and 16-bit count written as
+// two bytes to each register, high byte first
+#define IDE_CMD_R_PIO_EXT  0x24 // pio read
+#define IDE_CMD_W_PIO_EXT  0x34 // pio write
+#define IDE_CMD_MR_PIO_EXT 0x29 // pio multiple read
+#define IDE_CMD_MW_PIO_EXT 0x39 // pio multiple write
+#define IDE_CMD_R_DMA_EXT  0x25 // DMA read
+#define IDE_CMD_W_DMA_EXT  0x35 // DMA write
+#define IDE_CMD_FLUSH_EXT  0xea // flush write cache
+
+#define IDE_LBA28_MAX 0x10000000 // sectors addressable by LBA28
+
+// sector count register is 8 bits, 0 means 256
+#define IDE_MAX_SECT 256
+
+// bus master IDE, registers of primary channel at BAR4 of
+// the PCI IDE controller
+#define BM_CMD       0x0 // command
+#define BM_STATUS    0x2 // status
+#define BM_PRDT      0x4 // physical region descriptor table
+
+#define BM_CMD_START 0x1 // start transfer
+#define BM_CMD_READ  0x8 // disk to memory
+
+#define BM_ST_ACTIVE 0x1 // transfer in progress
+#define BM_ST_ERR    0x2 // DMA error, write 1 to clear
+#define BM_ST_INTR   0x4 // disk raised interrupt, write 1 to clear
+
+// physical region descriptor, a physically contiguous piece of
+// the buffer, it must not cross a 64KB boundary
+struct prd
+{
+    uint32_t addr;  // physical address
+    uint16_t len;   // bytes, 0 means 64KB
+    uint16_t flags; // PRD_EOT on last one
+}__attribute__((packed));
+
+#define PRD_EOT  0x8000
+#define IDE_NPRD 512 // 4KB, page aligned so it doesn't cross 64KB
+
+struct prd idePrdt[IDE_NPRD] __attribute__((aligned(4096)));
+uint16_t bmide; // bus master base port, 0 if there is no DMA
 
 #define SECSIZE     512 // sector size
 #define BSIZE       512 // default: block size = sector size = 512 bytes
@@ -49,6 +98,7 @@
 #define B_UNUSED 0x1 // the block has been allocated but not used
 #define B_VALID  0x2 // the block in-core is same with the copy on disk
 #define B_DIRTY  0x4 // the block in-core is different with the copy on disk
+#define B_ERROR  0x8 // the last disk request of the block failed
 
 // operating system are read from disk0, so
 // disk is exist in default. operating system
@@ -59,18 +109,51 @@ struct block
 {
     int flags;       // F_READ, F_WRITE
     int device;      // device number
-    int block;       // block number
+    sector_t block;  // block number
     int lruCnt;      // count of recent use
     char buf[BSIZE]; // date buffer
     struct block *lru_prev;
     struct block *lru_next;
     struct block *hash_prev;
     struct block *hash_next;
+    struct block *io_next; // next block of the same disk request
+    struct request *io_rq; // that request, waiters sleep on it
     spinlock_t lock;
 };
 
-// block wait queue
-struct block *blkWaitQueue;
+#define IDE_MAX_BLK (IDE_MAX_SECT / SEC_PER_BLK) // blocks per request
+
+// drives on the channel, 0-master, 1-slave
+struct ideDisk
+{
+    int present;         // answered IDENTIFY
+    int lba48;           // LBA48 feature set, identify word 83
+    int mult;            // sectors per DRQ block of READ/WRITE
+                         // MULTIPLE, 1 if multiple mode is off
+    sector_t nsect;      // addressable sectors
+    uint16_t ident[256]; // identify data
+};
+
+struct ideDisk ideDisks[2];
+
+// PIO progress of the active request
+struct block *ideXferBlk; // block being moved
+int ideXferSec;           // next sector in ideXferBlk
+struct bioVec *ideXferVec; // segment being moved, bio
+uint32_t ideXferOff;      // next byte in ideXferVec
+int ideXferLeft;          // sectors not moved yet
+int ideXferChunk;         // sectors per interrupt
+
+// request queue of the disk, its lock also guards the
+// controller. blocks in a request are off LRU list
+struct reqQueue ideQueue;
+struct request *ideActive; // request on the disk, NULL if idle
+
+// finished requests, from interrupt handler to bottom half which
+// wakes up their threads
+#define IDE_NDONE 64
+struct ring ideDone;
+void *ideDoneSlots[IDE_NDONE];
 
 // testIdetState: check if the ide is ready
 // parameters: void
@@ -82,22 +165,121 @@ int testIdeState();
 // outputs   : success or fail
 int hardDriverInit();
 
-// hardRead: read from disk
+// ideDmaInit: find PCI IDE controller and its bus master base,
+//             DMA is used if there is one, otherwise PIO
+// parameters: void
+// outputs   : 0-DMA, -1-PIO only
+int ideDmaInit();
+
+// idePrdBuild: append PRDs covering buf to idePrdt, split at
+//              page boundaries
+// parameters: n-PRDs already in table
+//             buf-buffer, identity mapped kernel memory
+//             len-bytes
+// outputs   : PRDs in table, -1 if table is full
+int idePrdBuild(int n, void *buf, uint32_t len);
+
+// ideIdentify: read identify data of a drive, pick its address
+//              mode and size, and turn on multiple mode
+// parameters: dev-0 master, 1 slave
+// outputs   : 0-present, -1-no drive
+int ideIdentify(int dev);
+
+// ideSetMult: turn on multiple mode with the largest DRQ block
+//             the disk supports, identify word 47
+// parameters: dev-drive
+// outputs   : 0-on, -1-off, a DRQ block is one sector
+int ideSetMult(int dev);
+
+// ideSetLba: write address and sector count of a command, by
+//            LBA48 if the drive has it and the request needs
+//            it, else LBA28
+// parameters: dev-drive
+//             sector-first sector
+//             nsect-sectors
+// outputs   : 1-LBA48, use EXT command, 0-LBA28
+int ideSetLba(int dev, sector_t sector, int nsect);
+
+// ideXfer: move next DRQ block of the active request by PIO,
+//          with ideQueue.lock
+// parameters: out-1 write to disk, 0 read from disk
+// outputs   : void
+void ideXfer(int out);
+
+// ideStart: issue request rq, start function of ideQueue
+// parameters: q-ideQueue
+//             rq-request
+// outputs   : void
+void ideStart(struct reqQueue *q, struct request *rq);
+
+struct blkOps ideOps; // ideRw, ideBio, ideFlush, ideSize
+
+// ideRw: rw operation of IDE disks, on ideQueue
+// parameters: bd-disk, priv is drive number
+//             blks-blocks
+//             n-number of blocks
+//             write-1 write, 0 read
+//             start-offset on the disk
+// outputs   : success or not
+int ideRw(struct blkDev *bd, struct block **blks, int n, int write, sector_t start);
+
+// ideBio: bio operation of IDE disks, DMA or PIO right on the
+//         segments
+// parameters: bd-disk, priv is drive number
+//             bio-bio
+//             start-offset on the disk
+// outputs   : success or not
+int ideBio(struct blkDev *bd, struct bio *bio, sector_t start);
+
+// ideFlush: flush operation of IDE disks, FLUSH CACHE with the
+//           queue drained, polled
+// parameters: bd-disk, priv is drive number
+// outputs   : success or not
+int ideFlush(struct blkDev *bd);
+
+// ideSize: size operation of IDE disks
+// parameters: bd-disk, priv is drive number
+// outputs   : blocks on disk
+sector_t ideSize(struct blkDev *bd);
+
+// hardReadMulti: read blocks, the queue is plugged while they
+//                are submitted so consecutive ones are merged
+// parameters: blks-blocks
+//             n-number of blocks
+// outputs   : success or not
+int hardReadMulti(struct block **blks, int n);
+
+// hardWriteMulti: write blocks, like hardReadMulti
+// parameters: blks-blocks
+//             n-number of blocks
+// outputs   : success or not
+int hardWriteMulti(struct block **blks, int n);
+
+// hardRead: read from disk, queue the request and sleep until
+//           the interrupt handler has read the data. before
+//           threads run, wait for the interrupt busily
 // parameters: blk-read into this block
+// outputs   : success or not
+int hardRead(struct block *blk);
+
+// hardInterruptHandler: IDE interrupt, finish active request
+//                       and start next one
+// parameters: tf-trapframe
+//             ctx-unused
 // outputs   : void
-void hardRead(struct block *blk);
+void hardInterruptHandler(struct trapframe *tf, void *ctx);
 
-// hardInterruptHandler: hard intterurpt handler
+// hardBottomHalf: wake up threads whose requests are finished
 // parameters: void
 // outputs   : void
-void hardInterruptHandler();
+void hardBottomHalf();
 
 // hardReadWait: hard read (directly, not interrupt)
 // parameters: blk-read into this block
 // outputs   : success or not
 int hardReadWait(struct block *blk);
 
-// hardWrite: write to disk
+// hardWrite: write to disk, queued like hardRead
 // parameters: blk-write this block to disk
 // outputs   : success or not
 int hardWrite(struct block *blk);
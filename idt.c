@@ -1,14 +1,15 @@
 #include "idt.h"
 #include "gdt.h"
 #include "console.h"
-#include "keyboard.h"
-#include "timer.h"
 #include "port.h"
 #include "process.h"
 #include "thread.h"
 //#include "fs.h"
 #include "concurrency.h"
 #include "syscall.h"
+#include "softirq.h"
+#include "apic.h"
+#include "rcu.h"
 
 extern uint32_t interruptVectors[IDTSIZE];
 
@@ -31,8 +32,130 @@ void idInit(ide_t *id, uint32_t offset, uint16_t selector, uint8_t privilege)
     id->offsethigh16 = (offset >> 16) & 0xffff;
 }
 
+uint64_t rdtsc()
+{
+    uint64_t v;
+    asm volatile("rdtsc" : "=A"(v));
+    return v;
+}
+
+int registerIrqHandler(int vector, irqhandler_t handler, void *ctx)
+{
+    struct irqAction *act = NULL;
+
+    cli();
+    for(int i = 0; i < NIRQACTION; i++)
+    {
+        if(irqActions[i].handler == NULL)
+        {
+            act = &(irqActions[i]);
+            break;
+        }
+    }
+
+    if(act == NULL)
+    {
+        sti();
+        printf("[Error] registerIrqHandler: no free irqAction\n");
+        return -1;
+    }
+
+    // append to the chain, earlier drivers keep priority
+    act->handler = handler;
+    act->ctx = ctx;
+    act->next = NULL;
+    struct irqAction **pp = &(irqTable[vector]);
+    while(*pp != NULL)
+    {
+        pp = &((*pp)->next);
+    }
+    *pp = act;
+    sti();
+
+    return 0;
+}
+
+int unregisterIrqHandler(int vector, irqhandler_t handler, void *ctx)
+{
+    cli();
+    for(struct irqAction **pp = &(irqTable[vector]); *pp != NULL; pp = &((*pp)->next))
+    {
+        struct irqAction *act = *pp;
+        if(act->handler == handler && act->ctx == ctx)
+        {
+            *pp = act->next;
+            act->handler = NULL;
+            act->next = NULL;
+            sti();
+            return 0;
+        }
+    }
+    sti();
+
+    return -1;
+}
+
+void idtLoad()
+{
+    uint16_t idtr[3];
+    idtr[0] = sizeof(idt) - 1;
+    idtr[1] = (uint32_t)idt;
+    idtr[2] = ((uint32_t)idt) >> 16;
+
+    asm volatile("lidt (%0)" : : "r"(idtr));
+}
+
+uint32_t readEflags()
+{
+    uint32_t eflags;
+    asm volatile("pushfl; popl %0" : "=r"(eflags));
+    return eflags;
+}
+
+void irqEnable(int irq)
+{
+    if(haveApic)
+    {
+        ioapicEnable(irq, MASTER_BOUND + irq, lapicId());
+    }
+    else if(irq < 8)
+    {
+        outb(PIC_MASTER_DATA, inb(PIC_MASTER_DATA) & ~(1 << irq));
+    }
+    else
+    {
+        outb(PIC_SLAVE_DATA, inb(PIC_SLAVE_DATA) & ~(1 << (irq - 8)));
+        // slave is chained on master irq 2
+        outb(PIC_MASTER_DATA, inb(PIC_MASTER_DATA) & ~(1 << 2));
+    }
+}
+
+void irqStatDump()
+{
+    for(int i = 0; i < IDTSIZE; i++)
+    {
+        uint32_t count = 0;
+        uint64_t cycles = 0;
+        for(int c = 0; c < NCPU; c++)
+        {
+            struct irqStat *st = (struct irqStat *)percpuPtrCpu(irqStats, c) + i;
+            count += st->count;
+            cycles += st->cycles;
+        }
+        if(count > 0)
+        {
+            // no 64 bits division here, print kilo cycles
+            printf("[irq %d] count: %d, kcycles: %d\n", i, count,
+                   (uint32_t)(cycles >> 10));
+        }
+    }
+}
+
 void idtInit()
 {
+    // per-cpu, handlers on different cpus don't share lines
+    irqStats = percpuAlloc(sizeof(struct irqStat) * IDTSIZE);
+
     for(int i = 0; i < IDTSIZE; i++)
     {
         if(i == IDX_SYSCALL)
@@ -45,11 +168,6 @@ void idtInit()
         }
     }
 
-    uint16_t idtr[3];
-    idtr[0] = sizeof(idt) - 1;
-    idtr[1] = (uint32_t)idt;
-    idtr[2] = ((uint32_t)idt) >> 16;
-
     // master PIC edge trigger mode
     outb(PIC_MASTER_CMD, 0x11);
     // map IRQ 0-7 to int 0x20-0x27
@@ -72,47 +190,60 @@ void idtInit()
     outb(PIC_MASTER_DATA, 0x00);
     outb(PIC_SLAVE_DATA, 0x00);
 
-    asm volatile("lidt (%0)" : : "r"(idtr));
+    idtLoad();
+
+    for(int i = 0; i < IDTSIZE; i++)
+    {
+        irqTable[i] = NULL;
+    }
 
 }
 
 void handleInterrupt(struct trapframe *tf)
 {
-    //send EOI to pic
-    if(tf->trapno >= MASTER_BOUND)
+    uint32_t vec = tf->trapno;
+
+    // send EOI, a MMIO write to local APIC, or port
+    // writes to 8259 PIC. spurious interrupts and
+    // software interrupts need none
+    if(haveApic)
+    {
+        if(vec >= MASTER_BOUND && vec != IV_SYSCALL && vec != IV_SPURIOUS)
+        {
+            lapicEoi();
+        }
+    }
+    else if(vec >= MASTER_BOUND)
     {
         outb(PIC_MASTER_CMD, EOI);
-        if(tf->trapno >= SLAVE_BOUND)
+        if(vec >= SLAVE_BOUND)
         {
             outb(PIC_SLAVE_CMD, EOI);
         }
     }
 
-    switch (tf->trapno)
+    // top half, interrupts off, run every handler sharing vec
+    if(vec < IDTSIZE && irqTable[vec] != NULL)
     {
-    case IV_KEYBOARD:
-    {
-        kbdInterruptHandler();
-        break;
+        uint64_t start = rdtsc();
+        for(struct irqAction *act = irqTable[vec]; act != NULL; act = act->next)
+        {
+            act->handler(tf, act->ctx);
+        }
+        // interrupts are off, we stay on this cpu
+        struct irqStat *st = (struct irqStat *)percpuPtr(irqStats) + vec;
+        st->count++;
+        st->cycles += rdtsc() - start;
     }
-    case IV_TIMER:
+
+    // bottom half, interrupts on
+    bhRun();
+
+    // a thread in an rcu read section is not preempted, it
+    // is rescheduled on a later interrupt
+    if(needResched && (thr_current == NULL || thr_current->rcuNest == 0))
     {
-        //yield();
+        needResched = 0;
         thrYeild();
-        break;
-    }
-    case IV_IDE:
-    {
-        //hardInterruptHandler();
-        break;
     }
-    case IV_SYSCALL:
-    {
-        //syscall();
-        break;
-    }
-    default:
-        break;
-    }
-
-}
\ No newline at end of file
+}
@@ -2,6 +2,7 @@
 #define _IDT_H
 
 #include "types.h"
+#include "percpu.h"
 
 #define IDTSIZE                     256
 
@@ -11,6 +12,8 @@
 #define IT_TRAP                     0x8f
 #define IT_SYSCALL                  0xef
 
+#define FL_IF                       0x200 // interrupt enable
+
 #define IV_DEVIDE_ERROR                0
 #define IV_DEBUG                       1
 #define IV_NMI                         2
@@ -43,6 +46,16 @@
 #define IV_MOUSE                      36
 #define IV_IDE                        46
 
+// ISA irqs, vector = MASTER_BOUND + irq
+#define IRQ_TIMER                      0
+#define IRQ_KEYBOARD                   1
+#define IRQ_IDE                       14
+
+// local APIC vectors
+#define IV_IPI_CALL                 0xf0
+#define IV_APIC_ERROR               0xfe
+#define IV_SPURIOUS                 0xff
+
 #define IV_SYSCALL                    0x80
 
 #define IV_TEST_CODE                   3
@@ -97,6 +110,33 @@ struct trapframe
 typedef struct ide_t ide_t;
 ide_t idt[IDTSIZE];
 
+// interrupt handler table
+// drivers register handlers for their vectors, handleInterrupt
+// looks up the vector and runs every handler chained on it, so
+// devices can share a line. each handler must check if its own
+// device raised the interrupt
+#define NIRQACTION 64 // total handlers, all vectors
+
+typedef void (*irqhandler_t)(struct trapframe *tf, void *ctx);
+
+struct irqAction
+{
+    irqhandler_t handler;    // handler function
+    void *ctx;               // driver's argument for handler
+    struct irqAction *next;  // next handler sharing the vector
+};
+
+struct irqStat
+{
+    uint32_t count;  // times the vector was raised
+    uint64_t cycles; // cycles spent in its handlers (rdtsc)
+};
+
+struct irqAction irqActions[NIRQACTION];
+struct irqAction *irqTable[IDTSIZE];
+// struct irqStat[IDTSIZE] per cpu, summed by irqStatDump
+percpu_t irqStats;
+
 // sti: open interrupt
 // parameters: void
 // outputs   : void
@@ -120,6 +160,46 @@ void idInit(ide_t *id, uint32_t offset, uint16_t selector, uint8_t privilege);
 // outputs   : void
 void idtInit();
 
+// rdtsc: read time stamp counter
+// parameters: void
+// outputs   : cycles since reset
+uint64_t rdtsc();
+
+// registerIrqHandler: chain handler on vector
+// parameters: vector-interrupt vector
+//             handler-handler function
+//             ctx-argument passed to handler
+// outputs   : 0-success, -1-no free irqAction
+int registerIrqHandler(int vector, irqhandler_t handler, void *ctx);
+
+// unregisterIrqHandler: remove handler(ctx) from vector
+// parameters: vector-interrupt vector
+//             handler-handler function
+//             ctx-argument given when registered
+// outputs   : 0-success, -1-not registered
+int unregisterIrqHandler(int vector, irqhandler_t handler, void *ctx);
+
+// irqEnable: unmask ISA irq, on I/O APIC if there is one,
+//            otherwise on 8259 PIC. vector is MASTER_BOUND + irq
+// parameters: irq-ISA irq
+// outputs   : void
+void irqEnable(int irq);
+
+// irqStatDump: print count and cycles of raised vectors
+// parameters: void
+// outputs   : void
+void irqStatDump();
+
+// idtLoad: load idt on this cpu
+// parameters: void
+// outputs   : void
+void idtLoad();
+
+// readEflags: read %eflags
+// parameters: void
+// outputs   : eflags
+uint32_t readEflags();
+
 // interrupt: do interrupt
 // parameters: interruptNum-interrupt number
 // outputs   : void
@@ -0,0 +1,226 @@
+#include "ipi.h"
+#include "idt.h"
+#include "apic.h"
+#include "cpu.h"
+#include "concurrency.h"
+
+// ipiInterruptHandler: IV_IPI_CALL, run posted function call
+void ipiInterruptHandler(struct trapframe *tf, void *ctx)
+{
+    ipiPoll();
+}
+
+void ipiInit()
+{
+    registerIrqHandler(IV_IPI_CALL, ipiInterruptHandler, NULL);
+}
+
+void ipiSend(int cpu, int vector)
+{
+    // ICRHI and ICRLO are written in two steps, keep an
+    // interrupt handler on this cpu from sending in between
+    uint32_t eflags = readEflags();
+    cli();
+    lapicWrite(LAPIC_ICRHI, cpus[cpu].apicid << 24);
+    lapicWrite(LAPIC_ICRLO, vector);
+    lapicWait();
+    if(eflags & FL_IF)
+    {
+        sti();
+    }
+}
+
+void ipiBroadcast(int vector)
+{
+    uint32_t eflags = readEflags();
+    cli();
+    lapicWrite(LAPIC_ICRHI, 0);
+    lapicWrite(LAPIC_ICRLO, ICR_OTHERS | vector);
+    lapicWait();
+    if(eflags & FL_IF)
+    {
+        sti();
+    }
+}
+
+void ipiPoll()
+{
+    struct cpu *c = mycpu();
+    struct ipiCallReq *r = (struct ipiCallReq *)xchg((uint32_t *)&(c->call), 0);
+    if(r != NULL)
+    {
+        r->fn(r->arg);
+        r->done = 1;
+    }
+}
+
+// ipiPost: put r in cpu's call slot and interrupt it
+void ipiPost(int cpu, struct ipiCallReq *r)
+{
+    r->done = 0;
+    // slot is busy with another sender's call, help
+    // our own callers while waiting for it
+    while(cmpxchg((uint32_t *)&(cpus[cpu].call), 0, (uint32_t)r) != 0)
+    {
+        ipiPoll();
+        cpuRelax();
+    }
+    ipiSend(cpu, IV_IPI_CALL);
+}
+
+// ipiWait: wait for r to be done
+void ipiWait(struct ipiCallReq *r)
+{
+    while(!r->done)
+    {
+        ipiPoll();
+        cpuRelax();
+    }
+}
+
+void ipiCall(int cpu, void (*fn)(void *), void *arg)
+{
+    // stay on this cpu until the call is done, a thread moved
+    // to cpu would post to its own slot and wait forever.
+    // ipiWait polls our slot, calls to us still run
+    uint32_t eflags = readEflags();
+    cli();
+    if(cpu == mycpu()->id)
+    {
+        fn(arg);
+    }
+    else
+    {
+        struct ipiCallReq r;
+        r.fn = fn;
+        r.arg = arg;
+        ipiPost(cpu, &r);
+        ipiWait(&r);
+    }
+    if(eflags & FL_IF)
+    {
+        sti();
+    }
+}
+
+void ipiCallMany(uint32_t mask, void (*fn)(void *), void *arg)
+{
+    struct ipiCallReq r[NCPU];
+    // self must stay right until the last wait, as in ipiCall
+    uint32_t eflags = readEflags();
+    cli();
+    int self = mycpu()->id;
+
+    // post to all first, targets run fn in parallel
+    for(int i = 0; i < ncpu; i++)
+    {
+        if(i != self && (mask & (1 << i)))
+        {
+            r[i].fn = fn;
+            r[i].arg = arg;
+            ipiPost(i, &(r[i]));
+        }
+    }
+
+    for(int i = 0; i < ncpu; i++)
+    {
+        if(i != self && (mask & (1 << i)))
+        {
+            ipiWait(&(r[i]));
+        }
+    }
+    if(eflags & FL_IF)
+    {
+        sti();
+    }
+}
+
+void tlbBatchInit(struct tlbBatch *b, pde_t *pgd)
+{
+    b->pgd = pgd;
+    b->n = 0;
+    b->full = 0;
+}
+
+void tlbBatchAdd(struct tlbBatch *b, vaddr_t va)
+{
+    if(b->n < TLB_BATCH)
+    {
+        b->va[b->n++] = PGLOWBOUND(va);
+    }
+    else
+    {
+        b->full = 1;
+    }
+}
+
+// tlbFlushLocal: invalidate batch on this cpu
+void tlbFlushLocal(void *arg)
+{
+    struct tlbBatch *b = (struct tlbBatch *)arg;
+    if(b->full)
+    {
+        lcr3(rcr3());
+        return ;
+    }
+
+    for(int i = 0; i < b->n; i++)
+    {
+        invlpg(b->va[i]);
+    }
+}
+
+void tlbBatchFlush(struct tlbBatch *b)
+{
+    if(b->n == 0)
+    {
+        return ;
+    }
+
+    // ptes are written before we look at which cpus run pgd,
+    // a cpu switching to it later loads the new ptes
+    asm volatile("mfence" : : : "memory");
+
+    // the local flush and the mask are for the cpu we are on,
+    // don't move until the others are done
+    uint32_t eflags = readEflags();
+    cli();
+    struct cpu *c = mycpu();
+    uint32_t mask = 0;
+    for(int i = 0; i < ncpu; i++)
+    {
+        if(i == c->id || !cpus[i].started)
+        {
+            continue;
+        }
+        // kernel mappings are in every address space
+        if(b->pgd == kpgdir || cpus[i].pgd == b->pgd)
+        {
+            mask |= 1 << i;
+        }
+    }
+
+    if(b->pgd == kpgdir || c->pgd == b->pgd)
+    {
+        tlbFlushLocal(b);
+    }
+    if(mask != 0)
+    {
+        ipiCallMany(mask, tlbFlushLocal, b);
+    }
+    if(eflags & FL_IF)
+    {
+        sti();
+    }
+
+    b->n = 0;
+    b->full = 0;
+}
+
+void tlbShootdown(pde_t *pgd, vaddr_t va)
+{
+    struct tlbBatch b;
+    tlbBatchInit(&b, pgd);
+    tlbBatchAdd(&b, va);
+    tlbBatchFlush(&b);
+}
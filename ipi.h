@@ -0,0 +1,97 @@
+#ifndef _IPI_H
+#define _IPI_H
+
+#include "types.h"
+#include "memory.h"
+
+// inter-processor interrupts
+// a cpu interrupts others through its local APIC, on a fixed
+// vector. function calls on another cpu are posted in its
+// struct cpu call slot and the IPI_CALL vector makes it run
+// them. TLB shootdown is built on function calls
+
+#define TLB_BATCH 16 // pages in a batch, more flushes whole TLB
+
+// function call request, lives on sender's stack until done
+struct ipiCallReq
+{
+    void (*fn)(void *);
+    void *arg;
+    volatile int done;
+};
+
+// pages of one address space to invalidate together
+struct tlbBatch
+{
+    pde_t *pgd;             // address space
+    vaddr_t va[TLB_BATCH];  // pages
+    int n;
+    int full;               // too many pages, reload %cr3
+};
+
+// ipiInit: register IPI vectors
+// parameters: void
+// outputs   : void
+void ipiInit();
+
+// ipiSend: send fixed vector to a cpu
+// parameters: cpu-index in cpus
+//             vector-interrupt vector
+// outputs   : void
+void ipiSend(int cpu, int vector);
+
+// ipiBroadcast: send fixed vector to all other cpus
+// parameters: vector-interrupt vector
+// outputs   : void
+void ipiBroadcast(int vector);
+
+// ipiPoll: run function call posted to this cpu, if any.
+//          senders poll while they wait, so two cpus calling
+//          each other don't deadlock
+// parameters: void
+// outputs   : void
+void ipiPoll();
+
+// ipiCall: run fn(arg) on cpu and wait for it to finish,
+//          with interrupts off so the caller stays on its cpu.
+//          must not hold a spinlock the target may spin on
+// parameters: cpu-index in cpus
+//             fn-function
+//             arg-argument of fn
+// outputs   : void
+void ipiCall(int cpu, void (*fn)(void *), void *arg);
+
+// ipiCallMany: run fn(arg) on every cpu in mask, all at once,
+//              and wait for them. this cpu is skipped
+// parameters: mask-bit i for cpus[i]
+//             fn-function
+//             arg-argument of fn
+// outputs   : void
+void ipiCallMany(uint32_t mask, void (*fn)(void *), void *arg);
+
+// tlbBatchInit: start a batch of pages of pgd
+// parameters: b-batch
+//             pgd-address space
+// outputs   : void
+void tlbBatchInit(struct tlbBatch *b, pde_t *pgd);
+
+// tlbBatchAdd: add a page whose pte has changed
+// parameters: b-batch
+//             va-virtual address in the page
+// outputs   : void
+void tlbBatchAdd(struct tlbBatch *b, vaddr_t va);
+
+// tlbBatchFlush: invalidate the batch on this cpu and on cpus
+//                running pgd now. other cpus reload %cr3 when
+//                they switch to it, so they are left alone
+// parameters: b-batch
+// outputs   : void
+void tlbBatchFlush(struct tlbBatch *b);
+
+// tlbShootdown: invalidate one page everywhere
+// parameters: pgd-address space
+//             va-virtual address
+// outputs   : void
+void tlbShootdown(pde_t *pgd, vaddr_t va);
+
+#endif // _IPI_H
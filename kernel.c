@@ -10,6 +10,16 @@
 #include "ide.h"
 #include "fs.h"
 #include "user.h"
+#include "workqueue.h"
+#include "softirq.h"
+#include "apic.h"
+#include "cpu.h"
+#include "ipi.h"
+#include "rcu.h"
+#include "pci.h"
+#include "ahci.h"
+#include "virtio.h"
+#include "ramdisk.h"
 
 void kernelMain(const void* multiboot_structure, uint32_t multiboot_magic)
 {
@@ -25,17 +35,39 @@ void kernelMain(const void* multiboot_structure, uint32_t multiboot_magic)
 
     // 2. start segmentation and interrupts
     gdtInit();
+    // boot cpu's per-cpu data in %gs
+    cpuSetup(&(cpus[0]), 0);
+    ncpu = 1;
     idtInit();
+    // use local APIC and I/O APIC if ACPI reports them
+    apicInit();
+    ipiInit();
 
     // 3. initialize thread manager, for multitasking
+    rcuInit();
     thrInit();
     // thrTest();
     // cvTest();
+    // joinTest();
     // mtxTest();
+    // piTest();
     // semTest();
+    // rwTest();
+    bhInit();
+    wqInit(&syswq);
+    // wqTest();
+    // ringTest();
+    // pcounterTest();
+    // blkTest();
+    // blkPartTest();
 
-    // 4. initialize file system and shell
-    fsInit();
+    // 4. initialize file system and shell, disk controllers
+    //    are found on PCI
+    pciInit();
+    ahciInit();
+    vioInit();
+    fsInit(FS_ROOT_DEV);
+    // fsInit(rdInit(16)); // root file system in memory
     printf("arjenk@orcas: %s$ ", fileSys.cwd_name);
 
     // 5. initialize other device drivers, such as
@@ -43,4 +75,13 @@ void kernelMain(const void* multiboot_structure, uint32_t multiboot_magic)
     kbdDriverInit();
     timerDriverInit();
 
+    // 6. run shell commands in their own thread, keyboard
+    //    interrupt only queues scancodes
+    thrCreate(shell, NULL);
+
+    // 7. start other cpus, then schedule threads on boot
+    //    cpu too, never return
+    smpInit();
+    thrSchedStart();
+
 }
\ No newline at end of file
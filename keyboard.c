@@ -4,11 +4,21 @@
 #include "util.h"
 #include "fs.h"
 #include "user.h"
+#include "thread.h"
+#include "idt.h"
+#include "softirq.h"
 
 extern int pos = 0;
+spinlock_t kbdLock; // sleep/wakeup on kbdRing
 
 void kbdDriverInit()
 {
+    ringInit(&kbdRing, kbdSlots, KBD_BUFSIZE, RING_SP_ENQ | RING_SC_DEQ);
+    spinlockInit(&kbdLock);
+    bhRegister(IV_KEYBOARD, kbdBottomHalf);
+    registerIrqHandler(IV_KEYBOARD, kbdInterruptHandler, NULL);
+    irqEnable(IRQ_KEYBOARD);
+
     while(inb(KBD_CMD_PORT) & KBD_DATA_INBUF)
     {
         inb(KBD_DATA_PORT);
@@ -78,55 +88,103 @@ void parseCmd(char *line, char *cmd, char *arg)
     *p = '\0';
 }
 
-void kbdInterruptHandler()
+void kbdInterruptHandler(struct trapframe *tf, void *ctx)
 {
-    int x = 0, y = 0;
-    char key;
+    int key;
     if((key = getc()) != -1)
     {
+        // drop the key when shell falls behind
+        ringEnqueue(&kbdRing, (void *)key);
+        bhRaise(IV_KEYBOARD);
+    }
+}
+
+void kbdBottomHalf()
+{
+    // the shell checks the ring and sleeps under kbdLock, on
+    // another CPU too, so the signal can't fall in between
+    uint32_t eflags = spinlockLockSave(&kbdLock);
+    thrCondSignal(&kbdRing);
+    spinlockUnlockRestore(&kbdLock, eflags);
+}
+
+uint8_t kbdReadScancode()
+{
+    // kbdBottomHalf signals under kbdLock, so the wakeup
+    // can't slip in between the check and the sleep
+    void *key;
+    spinlockLock(&kbdLock);
+    while(ringDequeue(&kbdRing, &key) != 0)
+    {
+        thrCondWait(&kbdRing, &kbdLock);
+    }
+    spinlockUnlock(&kbdLock);
+
+    return (uint8_t)(uint32_t)key;
+}
+
+void runCmd(char *line)
+{
+    parseCmd(line, cmd, arg);
+    if(!strcmp(cmd, "ls"))
+    {
+        ls();
+    }
+    else if(!strcmp(cmd, "cd"))
+    {
+        cd(arg);
+    }
+    else if(!strcmp(cmd, "mkdir"))
+    {
+        mk(arg);
+    }
+    else
+    {
+        printf("\n'%s' command not found", cmd);
+    }
+}
+
+void shell(void *arg)
+{
+    int x = 0, y = 0;
+    uint8_t key;
+    for(;;)
+    {
+        key = kbdReadScancode();
         // break = make + 0x80
-        if(!(key & 0x80))
+        if(key & 0x80)
+        {
+            continue;
+        }
+
+        if((keymap[key] >= 'a' && keymap[key] <= 'z') || 
+           (keymap[key] >= '0' && keymap[key] <= '9') ||
+           (keymap[key] == ' '))
         {
-            //putc(keymap[key]);
-            if((keymap[key] >= 'a' && keymap[key] <= 'z') || 
-               (keymap[key] >= '0' && keymap[key] <= '9') ||
-               (keymap[key] == ' '))
+            if(pos < sizeof(line) - 1)
             {
                 putc(keymap[key]);
                 line[pos++] = keymap[key];
             }
-            else if(keymap[key] == '\b')
+        }
+        else if(keymap[key] == '\b')
+        {
+            if(pos > 0)
             {
                 getPos(&x, &y);
                 setPos(x, y - 1, ' ');
                 pos--;
             }
-            else if(keymap[key] == '\n')
+        }
+        else if(keymap[key] == '\n')
+        {
+            if(pos > 0)
             {
-                if(pos > 0)
-                {
-                    line[pos] = '\0';
-                    parseCmd(line, cmd, arg);
-                    if(!strcmp(cmd, "ls"))
-                    {
-                        ls();
-                    }
-                    else if(!strcmp(cmd, "cd"))
-                    {
-                        cd(arg);
-                    }
-                    else if(!strcmp(cmd, "mkdir"))
-                    {
-                        mk(arg);
-                    }
-                    else
-                    {
-                        printf("\n'%s' command not found", cmd);
-                    }
-                }
-                pos = 0;
-                printf("\narjenk@orcas: %s$ ", fileSys.cwd_name);
+                line[pos] = '\0';
+                runCmd(line);
             }
+            pos = 0;
+            printf("\narjenk@orcas: %s$ ", fileSys.cwd_name);
         }
     }
 }
@@ -2,6 +2,8 @@
 #define _KEYBOARD_H
 
 #include "types.h"
+#include "idt.h"
+#include "ring.h"
 
 #define KBD_DATA_PORT   0x60
 #define KBD_CMD_PORT    0x64
@@ -61,9 +63,39 @@ int pos;
 // outputs   : void
 void parseCmd(char *line, char *cmd, char *args);
 
-// kbdInterruptHandler: keyboard interrupt handler
+// scancode ring: the interrupt handler is the only producer,
+// the shell thread the only consumer. size must be power of two
+#define KBD_BUFSIZE 128
+
+struct ring kbdRing;
+void *kbdSlots[KBD_BUFSIZE];
+
+// kbdInterruptHandler: keyboard interrupt handler, only moves
+//                      scancode into kbdRing and raises bottom half
+// parameters: tf-trapframe
+//             ctx-unused
+// outputs   : void
+void kbdInterruptHandler(struct trapframe *tf, void *ctx);
+
+// kbdBottomHalf: keyboard bottom half, wake up shell
+// parameters: void
+// outputs   : void
+void kbdBottomHalf();
+
+// kbdReadScancode: take a scancode from kbdRing, sleep if empty
 // parameters: void
+// outputs   : scancode
+uint8_t kbdReadScancode();
+
+// runCmd: run a shell command line
+// parameters: line-command line
+// outputs   : void
+void runCmd(char *line);
+
+// shell: shell thread, edit lines and run commands, out of
+//        interrupt context
+// parameters: arg-unused
 // outputs   : void
-void kbdInterruptHandler();
+void shell(void *arg);
 
 #endif // _KEYBOARD_H
\ No newline at end of file
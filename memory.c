@@ -3,6 +3,8 @@
 #include "process.h"
 #include "util.h"
 #include "fs.h"
+#include "cpu.h"
+#include "ipi.h"
 
 extern char kernheap[];
 
@@ -31,6 +33,11 @@ int rcr3()
     return data;
 }
 
+void invlpg(vaddr_t va)
+{
+    asm volatile("invlpg (%0)" : : "r" (va) : "memory");
+}
+
 void lcr0(int val)
 {
     asm volatile("movl %0, %%cr0" : : "a" (val));
@@ -152,7 +159,13 @@ pte_t map(pde_t *pgd, paddr_t pa, vaddr_t va, uint16_t flags)
     
     //printf("ppn: %x\n", PPN(pa));
     pgd[PGDINDEX(plb)] = pde;
+    pte_t old = pgtbl[PGTINDEX(plb)];
     pgtbl[PGTINDEX(plb)] = (pte_t)(PPN(pa) | flags | PAGE_PRESENT);
+    // remapped, other cpus may cache the old translation
+    if((old & PAGE_PRESENT) && old != pgtbl[PGTINDEX(plb)])
+    {
+        tlbShootdown(pgd, plb);
+    }
 
     //printf("pte: %x\n", pgtbl[PGDINDEX(plb)]);
     return pgtbl[PGTINDEX(plb)];
@@ -172,6 +185,31 @@ void rangemap(pde_t *pgd, paddr_t pa, vaddr_t va, size_t size, uint16_t flags)
     }
 }
 
+void rangeunmap(pde_t *pgd, vaddr_t va, size_t size)
+{
+    struct tlbBatch b;
+    tlbBatchInit(&b, pgd);
+
+    vaddr_t vlb = PGLOWBOUND(va);
+    vaddr_t vub = PGUPBOUND(va + size);
+    while(vlb < vub)
+    {
+        pde_t pde = pgd[PGDINDEX(vlb)];
+        if(pde & PAGE_PRESENT)
+        {
+            pte_t *pgtbl = (pte_t *)(PPN(pde));
+            if(pgtbl[PGTINDEX(vlb)] & PAGE_PRESENT)
+            {
+                pgtbl[PGTINDEX(vlb)] = 0;
+                tlbBatchAdd(&b, vlb);
+            }
+        }
+        vlb += PGSIZE;
+    }
+
+    tlbBatchFlush(&b);
+}
+
 int pgenable()
 {
     // enable paging
@@ -219,6 +257,8 @@ void kmemInit()
 
 void switchpgt(pde_t *npgd)
 {
+    // ipi.c shoots down only cpus running the page table
+    mycpu()->pgd = npgd;
     lcr3(npgd);
 }
 
@@ -265,7 +305,15 @@ size_t vmalloc(pde_t *pgd, size_t oldsize, size_t newsize, int privilege)
 
 void vmfree(pde_t *pgd, void *p)
 {
-    
+    paddr_t pa = translate(pgd, (vaddr_t)p);
+    if(pa == 0)
+    {
+        return ;
+    }
+
+    // no cpu may still reach the page when it is reused
+    rangeunmap(pgd, (vaddr_t)p, 1);
+    freePage((void *)PPN(pa));
 }
 
 void *sbrk(size_t size)
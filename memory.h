@@ -108,6 +108,16 @@ void memset(void *addr, int data, int cnt);
 // outputs   : void
 void lcr3(int val);
 
+// rcr3: read %cr3
+// parameters: void
+// outputs   : value of %cr3
+int rcr3();
+
+// invlpg: invalidate TLB entry of the page holding va
+// parameters: va-virtual address
+// outputs   : void
+void invlpg(vaddr_t va);
+
 // lcr0: load value into %cr0, set to enable paging
 // parameters: val-load value
 // outputs   : void
@@ -146,6 +156,8 @@ pte_t getpte(pde_t *pgd, vaddr_t va);
 paddr_t translate(pde_t *pgd, vaddr_t va);
 
 // map: map physical address to virtual address, and return pte
+//      if va was mapped to another page, its TLB entries are
+//      shot down on all cpus
 // parameters: pgd-current process's page directory
 //             pa-physical address
 //             va-virtual address
@@ -161,6 +173,14 @@ pte_t map(pde_t *pgd, paddr_t pa, vaddr_t va, uint16_t flags);
 // outputs  : void
 void rangemap(pde_t *pgd, paddr_t pa, vaddr_t va, size_t size, uint16_t flags);
 
+// rangeunmap: unmap pages in a certain range, TLB entries are
+//             shot down in one batch
+// parameters: pgd-current process's page directory
+//             va-virtual address
+//             size-range size
+// outputs   : void
+void rangeunmap(pde_t *pgd, vaddr_t va, size_t size);
+
 // test: page mapping test
 void mapTest();
 
@@ -188,7 +208,11 @@ pde_t *copypgt(pde_t *opgd, size_t size);
 //             privilege-kernel or user
 // outputs  :  new space size
 size_t vmalloc(pde_t *pgd, size_t oldsize, size_t newsize, int privilege);
-// TODO: vmfree
+
+// vmfree: unmap the page holding p and free it
+// parameters: pgd-current process's page directory
+//             p-virtual address in the page
+// outputs   : void
 void vmfree(pde_t *pgd, void *p);
 
 // Test: malloc/free test
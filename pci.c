@@ -0,0 +1,103 @@
+#include "pci.h"
+#include "port.h"
+#include "console.h"
+
+uint32_t pciRead(int bus, int dev, int func, int off)
+{
+    outl(PCI_CONFIG_ADDR, 0x80000000 | (bus << 16) | (dev << 11) | (func << 8) | (off & 0xfc));
+    return inl(PCI_CONFIG_DATA);
+}
+
+void pciWrite(int bus, int dev, int func, int off, uint32_t val)
+{
+    outl(PCI_CONFIG_ADDR, 0x80000000 | (bus << 16) | (dev << 11) | (func << 8) | (off & 0xfc));
+    outl(PCI_CONFIG_DATA, val);
+}
+
+// pciProbe: remember function if it exists
+void pciProbe(int bus, int dev, int func)
+{
+    uint32_t id = pciRead(bus, dev, func, PCI_ID);
+    if((id & 0xffff) == 0xffff || npciDev == NPCIDEV)
+    {
+        return ;
+    }
+
+    struct pciDev *d = &(pciDevs[npciDev++]);
+    d->bus = bus;
+    d->dev = dev;
+    d->func = func;
+    d->vendor = id & 0xffff;
+    d->device = id >> 16;
+
+    uint32_t cls = pciRead(bus, dev, func, PCI_CLASS);
+    d->class = cls >> 24;
+    d->subclass = (cls >> 16) & 0xff;
+    d->progif = (cls >> 8) & 0xff;
+
+    for(int i = 0; i < 6; i++)
+    {
+        d->bar[i] = pciRead(bus, dev, func, PCI_BAR0 + i * 4);
+    }
+    d->irq = pciRead(bus, dev, func, PCI_INTR) & 0xff;
+}
+
+void pciInit()
+{
+    npciDev = 0;
+    for(int bus = 0; bus < 256; bus++)
+    {
+        for(int dev = 0; dev < 32; dev++)
+        {
+            uint32_t id = pciRead(bus, dev, 0, PCI_ID);
+            if((id & 0xffff) == 0xffff)
+            {
+                continue;
+            }
+
+            // other functions only on multi-function devices
+            int nfunc = 1;
+            if((pciRead(bus, dev, 0, PCI_HEADER) >> 16) & PCI_HDR_MULTI)
+            {
+                nfunc = 8;
+            }
+            for(int func = 0; func < nfunc; func++)
+            {
+                pciProbe(bus, dev, func);
+            }
+        }
+    }
+
+    printf("[pci] %d devices\n", npciDev);
+}
+
+struct pciDev *pciFindClass(int class, int subclass, int n)
+{
+    for(int i = 0; i < npciDev; i++)
+    {
+        if(pciDevs[i].class == class && pciDevs[i].subclass == subclass && n-- == 0)
+        {
+            return &(pciDevs[i]);
+        }
+    }
+    return NULL;
+}
+
+struct pciDev *pciFindId(int vendor, int device, int n)
+{
+    for(int i = 0; i < npciDev; i++)
+    {
+        if(pciDevs[i].vendor == vendor && pciDevs[i].device == device && n-- == 0)
+        {
+            return &(pciDevs[i]);
+        }
+    }
+    return NULL;
+}
+
+void pciEnable(struct pciDev *d)
+{
+    uint32_t cmd = pciRead(d->bus, d->dev, d->func, PCI_COMMAND);
+    cmd |= PCI_CMD_IO | PCI_CMD_MEM | PCI_CMD_MASTER;
+    pciWrite(d->bus, d->dev, d->func, PCI_COMMAND, cmd & 0xffff);
+}
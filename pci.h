@@ -0,0 +1,91 @@
+#ifndef _PCI_H
+#define _PCI_H
+
+#include "types.h"
+
+// PCI configuration space, mechanism #1
+#define PCI_CONFIG_ADDR 0xcf8
+#define PCI_CONFIG_DATA 0xcfc
+
+// configuration registers, offsets in bytes
+#define PCI_ID       0x00 // device id << 16 | vendor id
+#define PCI_COMMAND  0x04 // status << 16 | command
+#define PCI_CLASS    0x08 // class, subclass, prog if, revision
+#define PCI_HEADER   0x0c // header type in bits 16-23
+#define PCI_BAR0     0x10 // base address registers, 6 of them
+#define PCI_INTR     0x3c // interrupt line in bits 0-7
+
+#define PCI_CMD_IO     0x1 // respond to I/O space
+#define PCI_CMD_MEM    0x2 // respond to memory space
+#define PCI_CMD_MASTER 0x4 // bus master, for DMA
+
+#define PCI_BAR_IO     0x1 // I/O space BAR
+
+#define PCI_HDR_MULTI  0x80 // multi-function device
+
+// class codes
+#define PCI_CLASS_STORAGE 0x01
+#define PCI_SUB_IDE       0x01
+#define PCI_SUB_SATA      0x06
+
+#define NPCIDEV 32 // devices remembered at enumeration
+
+struct pciDev
+{
+    uint8_t bus;
+    uint8_t dev;
+    uint8_t func;
+    uint16_t vendor;
+    uint16_t device;
+    uint8_t class;
+    uint8_t subclass;
+    uint8_t progif;
+    uint32_t bar[6];
+    uint8_t irq;      // legacy interrupt line
+};
+
+struct pciDev pciDevs[NPCIDEV];
+int npciDev;
+
+// pciRead: read a configuration dword
+// parameters: bus-bus number
+//             dev-device number
+//             func-function number
+//             off-register offset, dword aligned
+// outputs   : register value
+uint32_t pciRead(int bus, int dev, int func, int off);
+
+// pciWrite: write a configuration dword
+// parameters: bus-bus number
+//             dev-device number
+//             func-function number
+//             off-register offset, dword aligned
+//             val-value
+// outputs   : void
+void pciWrite(int bus, int dev, int func, int off, uint32_t val);
+
+// pciInit: enumerate devices on all buses into pciDevs
+// parameters: void
+// outputs   : void
+void pciInit();
+
+// pciFindClass: find nth device of class and subclass
+// parameters: class-class code
+//             subclass-subclass code
+//             n-skip first n matches
+// outputs   : device, NULL if not found
+struct pciDev *pciFindClass(int class, int subclass, int n);
+
+// pciFindId: find nth device with vendor and device id
+// parameters: vendor-vendor id
+//             device-device id
+//             n-skip first n matches
+// outputs   : device, NULL if not found
+struct pciDev *pciFindId(int vendor, int device, int n);
+
+// pciEnable: enable I/O, memory decoding and bus mastering
+// parameters: d-device
+// outputs   : void
+void pciEnable(struct pciDev *d);
+
+#endif // _PCI_H
@@ -0,0 +1,73 @@
+#include "percpu.h"
+#include "console.h"
+#include "concurrency.h"
+
+uint32_t percpuUsed; // allocated bytes, same in every area
+
+percpu_t percpuAlloc(uint32_t size)
+{
+    size = (size + 3) & ~3;
+    uint32_t off = xadd(&percpuUsed, size);
+    if(off + size > PERCPU_SIZE)
+    {
+        printf("[Error] percpuAlloc: no room for %d bytes\n", size);
+        return PERCPU_SIZE;
+    }
+    return off;
+}
+
+void *percpuPtr(percpu_t off)
+{
+    return mycpu()->percpu + off;
+}
+
+void *percpuPtrCpu(percpu_t off, int cpu)
+{
+    return cpus[cpu].percpu + off;
+}
+
+pcounter_t pcounterAlloc()
+{
+    return percpuAlloc(sizeof(uint32_t));
+}
+
+void pcounterAdd(pcounter_t pc, int n)
+{
+    asm volatile("addl %1, %%gs:(%0)" : :
+                 "r" (__builtin_offsetof(struct cpu, percpu) + pc), "ri" (n) :
+                 "memory", "cc");
+}
+
+void pcounterInc(pcounter_t pc)
+{
+    asm volatile("incl %%gs:(%0)" : :
+                 "r" (__builtin_offsetof(struct cpu, percpu) + pc) :
+                 "memory", "cc");
+}
+
+uint32_t pcounterRead(pcounter_t pc)
+{
+    uint32_t sum = 0;
+    for(int i = 0; i < NCPU; i++)
+    {
+        sum += pcounterReadCpu(pc, i);
+    }
+    return sum;
+}
+
+uint32_t pcounterReadCpu(pcounter_t pc, int cpu)
+{
+    return *(volatile uint32_t *)percpuPtrCpu(pc, cpu);
+}
+
+void pcounterTest()
+{
+    pcounter_t pc = pcounterAlloc();
+    for(int i = 0; i < 100; i++)
+    {
+        pcounterInc(pc);
+    }
+    pcounterAdd(pc, 23);
+    printf("pcounter: cpu %d has %d, sum %d\n", mycpu()->id,
+           pcounterReadCpu(pc, mycpu()->id), pcounterRead(pc));
+}
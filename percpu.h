@@ -0,0 +1,68 @@
+#ifndef _PERCPU_H
+#define _PERCPU_H
+
+#include "types.h"
+#include "cpu.h"
+
+// per-cpu data
+// each struct cpu ends with a cache line aligned area of
+// PERCPU_SIZE bytes. percpuAlloc hands out the same offset in
+// every cpu's area, a cpu only writes its own copy, so hot
+// path updates never touch a line shared with another cpu.
+// %gs selects this cpu's struct cpu, so a counter is bumped
+// by one instruction, which can't be split by an interrupt
+// or by moving to another cpu
+
+// offset of a per-cpu variable in the area
+typedef uint32_t percpu_t;
+// per-cpu counter, summed over cpus on read
+typedef percpu_t pcounter_t;
+
+// percpuAlloc: allocate a per-cpu variable, zeroed, at boot
+// parameters: size-bytes
+// outputs   : offset of the variable, PERCPU_SIZE if no room
+percpu_t percpuAlloc(uint32_t size);
+
+// percpuPtr: this cpu's copy of a per-cpu variable, caller
+//            should keep interrupts off while using it
+// parameters: off-per-cpu variable
+// outputs   : address
+void *percpuPtr(percpu_t off);
+
+// percpuPtrCpu: copy of a per-cpu variable on cpu
+// parameters: off-per-cpu variable
+//             cpu-index in cpus
+// outputs   : address
+void *percpuPtrCpu(percpu_t off, int cpu);
+
+// pcounterAlloc: allocate a per-cpu counter
+// parameters: void
+// outputs   : counter
+pcounter_t pcounterAlloc();
+
+// pcounterAdd: add n to this cpu's counter
+// parameters: pc-counter
+//             n-value
+// outputs   : void
+void pcounterAdd(pcounter_t pc, int n);
+
+// pcounterInc: add 1 to this cpu's counter
+// parameters: pc-counter
+// outputs   : void
+void pcounterInc(pcounter_t pc);
+
+// pcounterRead: sum of counter over all cpus
+// parameters: pc-counter
+// outputs   : sum
+uint32_t pcounterRead(pcounter_t pc);
+
+// pcounterReadCpu: counter of one cpu
+// parameters: pc-counter
+//             cpu-index in cpus
+// outputs   : value
+uint32_t pcounterReadCpu(pcounter_t pc, int cpu);
+
+// Test: per-cpu counter test
+void pcounterTest();
+
+#endif // _PERCPU_H
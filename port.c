@@ -12,6 +12,30 @@ void outb(uint16_t port, uint8_t data)
     asm volatile("out %0, %1" : : "a"(data), "d"(port));
 }
 
+uint16_t inw(uint16_t port)
+{
+    uint16_t data;
+    asm volatile("inw %1, %0" : "=a"(data) : "d"(port));
+    return data;
+}
+
+void outw(uint16_t port, uint16_t data)
+{
+    asm volatile("outw %0, %1" : : "a"(data), "d"(port));
+}
+
+uint32_t inl(uint16_t port)
+{
+    uint32_t data;
+    asm volatile("inl %1, %0" : "=a"(data) : "d"(port));
+    return data;
+}
+
+void outl(uint16_t port, uint32_t data)
+{
+    asm volatile("outl %0, %1" : : "a"(data), "d"(port));
+}
+
 void insl(uint16_t port, void *addr, int cnt)
 {
     asm volatile("cld; rep insl" :
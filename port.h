@@ -19,6 +19,27 @@ uint8_t inb(uint16_t port);
 // outputs   : void
 void outb(uint16_t port, uint8_t data);
 
+// port interface for word and dword: inw, outw, inl, outl
+// inw: read a word from port
+// parameters: port-port
+// outputs   : return readed word
+uint16_t inw(uint16_t port);
+
+// outw: write a word to port
+// parameters: port-port, data-data
+// outputs   : void
+void outw(uint16_t port, uint16_t data);
+
+// inl: read a dword from port
+// parameters: port-port
+// outputs   : return readed dword
+uint32_t inl(uint16_t port);
+
+// outl: write a dword to port
+// parameters: port-port, data-data
+// outputs   : void
+void outl(uint16_t port, uint32_t data);
+
 // insl: read stream from port, for hard driver
 // parameters: port-port
 //             addr-destination address to write
@@ -0,0 +1,167 @@
+#include "ramdisk.h"
+#include "memory.h"
+#include "console.h"
+#include "idt.h"
+#include "fs.h"
+
+struct blkOps rdOps = {rdRw, rdBio, NULL, rdSize}; // memory has no cache to flush
+
+int rdInit(int npage)
+{
+    if(nramdisk == NRAMDISK || npage <= 0 || npage > RD_NPAGE)
+    {
+        return -1;
+    }
+
+    struct ramdisk *rd = &(ramdisks[nramdisk]);
+    rd->device = RD_DEV_BASE + nramdisk;
+    rd->npage = npage;
+    for(int i = 0; i < npage; i++)
+    {
+        rd->pages[i] = allocPage();
+        memset(rd->pages[i], 0, PGSIZE);
+    }
+    if(blkDevRegister(rd->device, "rd", &rdOps, NULL, rd) != 0)
+    {
+        return -1;
+    }
+    nramdisk++;
+    return rd->device;
+}
+
+int rdRw(struct blkDev *bd, struct block **blks, int n, int write, sector_t start)
+{
+    struct ramdisk *rd = bd->priv;
+    uint32_t nblk = rd->npage * (PGSIZE / BSIZE);
+    int err = 0;
+    for(int i = 0; i < n; i++)
+    {
+        struct block *blk = blks[i];
+        if(blk->block + start >= nblk)
+        {
+            blk->flags |= B_ERROR;
+            err = -1;
+            continue;
+        }
+
+        // a block never crosses a page, BSIZE divides PGSIZE
+        uint32_t off = (uint32_t)(blk->block + start) * BSIZE;
+        char *p = rd->pages[off / PGSIZE] + off % PGSIZE;
+        if(write)
+        {
+            memmove(p, blk->buf, BSIZE);
+        }
+        else
+        {
+            memmove(blk->buf, p, BSIZE);
+        }
+        blk->flags = (blk->flags & ~(B_DIRTY | B_ERROR)) | B_VALID;
+    }
+    return err;
+}
+
+int rdBio(struct blkDev *bd, struct bio *bio, sector_t start)
+{
+    struct ramdisk *rd = bd->priv;
+    uint32_t nblk = rd->npage * (PGSIZE / BSIZE);
+    if(bio->block + start + bio->nblk > nblk)
+    {
+        bio->flags = B_ERROR;
+        return -1;
+    }
+
+    uint32_t blk = (uint32_t)(bio->block + start);
+    for(int i = 0; i < bio->nvec; i++)
+    {
+        struct bioVec *v = &(bio->vec[i]);
+        for(uint32_t done = 0; done < v->len; done += BSIZE, blk++)
+        {
+            uint32_t off = blk * BSIZE;
+            char *p = rd->pages[off / PGSIZE] + off % PGSIZE;
+            char *m = v->page + v->off + done;
+            if(bio->write)
+            {
+                memmove(p, m, BSIZE);
+            }
+            else
+            {
+                memmove(m, p, BSIZE);
+            }
+        }
+    }
+    bio->flags = B_VALID;
+    return 0;
+}
+
+sector_t rdSize(struct blkDev *bd)
+{
+    return ((struct ramdisk *)bd->priv)->npage * (PGSIZE / BSIZE);
+}
+
+void rdTest()
+{
+    struct block blk;
+    struct block *cblks[64];
+    int dev = rdInit(16);
+    if(dev < 0)
+    {
+        printf("[Error] rdTest: rdInit\n");
+        return ;
+    }
+
+    // 1. write through the cache
+    uint64_t start = rdtsc();
+    for(int i = 0; i < 64; i++)
+    {
+        blk.device = dev;
+        blk.block = i;
+        memset(blk.buf, i, BSIZE);
+        if(blockWrite(&blk) != 0)
+        {
+            printf("[Error] rdTest: write\n");
+            return ;
+        }
+    }
+    uint32_t wcycles = (uint32_t)(rdtsc() - start);
+
+    // 2. read back, all in cache
+    start = rdtsc();
+    for(int i = 0; i < 64; i++)
+    {
+        cblks[i] = blockRead(dev, i);
+        if(cblks[i] == NULL)
+        {
+            printf("[Error] rdTest: read\n");
+            return ;
+        }
+    }
+    uint32_t hcycles = (uint32_t)(rdtsc() - start);
+
+    // 3. drop them and read again from the disk
+    for(int i = 0; i < 64; i++)
+    {
+        relCachedBlock(cblks[i]);
+    }
+    start = rdtsc();
+    for(int i = 0; i < 64; i++)
+    {
+        cblks[i] = blockRead(dev, i);
+        if(cblks[i] == NULL)
+        {
+            printf("[Error] rdTest: read\n");
+            return ;
+        }
+    }
+    uint32_t mcycles = (uint32_t)(rdtsc() - start);
+
+    for(int i = 0; i < 64; i++)
+    {
+        if(cblks[i]->buf[0] != (char)i || cblks[i]->buf[BSIZE - 1] != (char)i)
+        {
+            printf("[Error] rdTest: block %d differs\n", i);
+            return ;
+        }
+    }
+    printf("[rdTest] 64 blocks, write %d cycles, read hit %d cycles, read miss %d cycles\n",
+           wcycles, hcycles, mcycles);
+}
@@ -0,0 +1,61 @@
+#ifndef _RAMDISK_H
+#define _RAMDISK_H
+
+#include "types.h"
+#include "ide.h"
+#include "blk.h"
+#include "virtio.h"
+
+// RAM disk
+// blocks kept in pages from the kernel heap, a transfer is a
+// copy done at once. the file system and the block cache can
+// run on it at memory speed, without a disk behind
+
+#define RD_DEV_BASE (VIO_DEV_BASE + VIO_NDEV)
+#define RD_NPAGE    1024 // max pages of a RAM disk, 4MB
+#define NRAMDISK    2
+
+struct ramdisk
+{
+    int device;            // device number
+    int npage;             // pages allocated
+    char *pages[RD_NPAGE]; // storage, not contiguous
+};
+
+struct ramdisk ramdisks[NRAMDISK];
+int nramdisk;
+
+struct blkOps rdOps; // rdRw, rdBio, rdSize, no flush
+
+// rdInit: make a RAM disk of zeroed pages and register it
+// parameters: npage-size in pages, no more than RD_NPAGE
+// outputs   : device number, -1 if no more RAM disk
+int rdInit(int npage);
+
+// rdRw: rw operation of RAM disks, copies the blocks
+// parameters: bd-disk, priv is the RAM disk
+//             blks-blocks
+//             n-number of blocks
+//             write-1 write, 0 read
+//             start-offset on the disk
+// outputs   : success, -1 if a block is out of the disk
+int rdRw(struct blkDev *bd, struct block **blks, int n, int write, sector_t start);
+
+// rdBio: bio operation of RAM disks, copies the segments
+// parameters: bd-disk, priv is the RAM disk
+//             bio-bio
+//             start-offset on the disk
+// outputs   : success, -1 if the bio is out of the disk
+int rdBio(struct blkDev *bd, struct bio *bio, sector_t start);
+
+// rdSize: size operation of RAM disks
+// parameters: bd-disk, priv is the RAM disk
+// outputs   : blocks on disk
+sector_t rdSize(struct blkDev *bd);
+
+// Test: RAM disk test, write and read back a run of blocks
+//       through the buffer cache and print the cycles they
+//       take, cache hits and misses apart. run after fsInit
+void rdTest();
+
+#endif // _RAMDISK_H
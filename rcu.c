@@ -0,0 +1,146 @@
+#include "rcu.h"
+#include "cpu.h"
+#include "idt.h"
+#include "thread.h"
+
+void rcuInit()
+{
+    spinlockInit(&(rcu.lock));
+    rcu.qsMask = 0;
+    rcu.gpActive = 0;
+    rcu.gpCount = 0;
+    rcu.curList = NULL;
+    rcu.nextList = NULL;
+    rcu.nextTail = &(rcu.nextList);
+}
+
+void rcuReadLock()
+{
+    // a thread's own pointer doesn't change if it moves to
+    // another cpu, so no need to close interrupts here
+    thread_t *t = thr_current;
+    if(t != NULL)
+    {
+        t->rcuNest++;
+    }
+    asm volatile("" : : : "memory");
+}
+
+void rcuReadUnlock()
+{
+    asm volatile("" : : : "memory");
+    thread_t *t = thr_current;
+    if(t != NULL)
+    {
+        t->rcuNest--;
+    }
+}
+
+// rcuStartGp: start a grace period for nextList, with rcu.lock
+void rcuStartGp()
+{
+    if(rcu.gpActive || rcu.nextList == NULL)
+    {
+        return ;
+    }
+
+    rcu.curList = rcu.nextList;
+    rcu.nextList = NULL;
+    rcu.nextTail = &(rcu.nextList);
+
+    uint32_t mask = 0;
+    for(int i = 0; i < ncpu; i++)
+    {
+        mask |= 1 << i;
+    }
+    rcu.gpActive = 1;
+    rcu.qsMask = mask;
+}
+
+void rcuQs(struct cpu *c)
+{
+    uint32_t bit = 1 << c->id;
+    struct rcuHead *done = NULL;
+
+    // fast path, nothing asked of this cpu
+    if((rcu.qsMask & bit) == 0)
+    {
+        return ;
+    }
+
+    uint32_t eflags = spinlockLockSave(&(rcu.lock));
+    rcu.qsMask &= ~bit;
+    if(rcu.gpActive && rcu.qsMask == 0)
+    {
+        done = rcu.curList;
+        rcu.curList = NULL;
+        rcu.gpActive = 0;
+        rcu.gpCount++;
+        rcuStartGp();
+    }
+    spinlockUnlockRestore(&(rcu.lock), eflags);
+
+    while(done != NULL)
+    {
+        struct rcuHead *next = done->next;
+        done->func(done);
+        done = next;
+    }
+}
+
+void callRcu(struct rcuHead *head, void (*func)(struct rcuHead *head))
+{
+    head->func = func;
+    head->next = NULL;
+
+    uint32_t eflags = spinlockLockSave(&(rcu.lock));
+    *(rcu.nextTail) = head;
+    rcu.nextTail = &(head->next);
+    rcuStartGp();
+    spinlockUnlockRestore(&(rcu.lock), eflags);
+}
+
+struct rcuSync
+{
+    struct rcuHead head;
+    volatile int done;
+};
+
+// rcuSyncDone: callback of synchronizeRcu, wake the waiter
+void rcuSyncDone(struct rcuHead *head)
+{
+    struct rcuSync *s = rcuEntry(head, struct rcuSync, head);
+    uint32_t eflags = spinlockLockSave(&(rcu.lock));
+    s->done = 1;
+    spinlockUnlockRestore(&(rcu.lock), eflags);
+    thrCondBroadcast(s);
+}
+
+void synchronizeRcu()
+{
+    struct rcuSync s;
+    s.done = 0;
+    callRcu(&(s.head), rcuSyncDone);
+
+    // the caller is outside any read section, which is a
+    // quiescent state of this cpu. it may end the grace
+    // period in progress and then ours, on one cpu we never
+    // have to sleep
+    for(int i = 0; i < 2 && !s.done; i++)
+    {
+        uint32_t eflags = readEflags();
+        cli();
+        rcuQs(mycpu());
+        if(eflags & FL_IF)
+        {
+            sti();
+        }
+    }
+
+    spinlockLock(&(rcu.lock));
+    while(!s.done)
+    {
+        thrCondWait(&s, &(rcu.lock));
+    }
+    spinlockUnlock(&(rcu.lock));
+}
@@ -0,0 +1,81 @@
+#ifndef _RCU_H
+#define _RCU_H
+
+#include "types.h"
+#include "concurrency.h"
+
+// read-copy-update, quiescent state based
+// readers take no lock, they only mark a read section in which
+// they can't sleep or be preempted. writers unlink an object
+// and reuse it only after a grace period: every cpu has passed
+// a quiescent state (a context switch in the scheduler), so no
+// reader that could have seen the object is still running
+
+struct cpu;
+
+// deferred callback, embedded in the protected object
+struct rcuHead
+{
+    struct rcuHead *next;
+    void (*func)(struct rcuHead *head);
+};
+
+struct rcuState
+{
+    spinlock_t lock;
+    volatile uint32_t qsMask;  // cpus yet to pass a quiescent state
+    int gpActive;              // grace period in progress
+    uint32_t gpCount;          // completed grace periods
+    struct rcuHead *curList;   // wait for current grace period
+    struct rcuHead *nextList;  // wait for next grace period
+    struct rcuHead **nextTail;
+};
+
+struct rcuState rcu;
+
+// rcuEntry: object holding rcuHead ptr
+#define rcuEntry(ptr, type, member) \
+    ((type *)((char *)(ptr) - (uint32_t)&(((type *)0)->member)))
+
+// rcuDereference: load a pointer published by rcuAssign
+#define rcuDereference(p) (*(typeof(p) volatile *)&(p))
+
+// rcuAssign: publish v in p, stores that initialize *v
+//            are visible before it
+#define rcuAssign(p, v) \
+    do { asm volatile("" : : : "memory"); (p) = (v); } while(0)
+
+// rcuInit: initialize rcu state
+// parameters: void
+// outputs   : void
+void rcuInit();
+
+// rcuReadLock: enter read section, nests
+// parameters: void
+// outputs   : void
+void rcuReadLock();
+
+// rcuReadUnlock: leave read section
+// parameters: void
+// outputs   : void
+void rcuReadUnlock();
+
+// rcuQs: report quiescent state of cpu c, run callbacks whose
+//        grace period has ended. called by the scheduler
+// parameters: c-cpu
+// outputs   : void
+void rcuQs(struct cpu *c);
+
+// callRcu: call func(head) after a grace period, func runs in
+//          scheduler context and must not sleep
+// parameters: head-rcuHead in the object
+//             func-callback
+// outputs   : void
+void callRcu(struct rcuHead *head, void (*func)(struct rcuHead *head));
+
+// synchronizeRcu: wait for a grace period, may sleep
+// parameters: void
+// outputs   : void
+void synchronizeRcu();
+
+#endif // _RCU_H
@@ -0,0 +1,214 @@
+#include "ring.h"
+#include "concurrency.h"
+#include "thread.h"
+#include "console.h"
+
+int ringInit(struct ring *r, void **slots, uint32_t size, int flags)
+{
+    if(size == 0 || (size & (size - 1)) != 0)
+    {
+        return -1;
+    }
+
+    r->size = size;
+    r->mask = size - 1;
+    r->flags = flags;
+    r->prodHead = 0;
+    r->prodTail = 0;
+    r->consHead = 0;
+    r->consTail = 0;
+    r->slots = slots;
+    return 0;
+}
+
+int ringEnqueueBurst(struct ring *r, void **objs, int n)
+{
+    uint32_t head, next, nfree;
+
+    // 1. reserve n slots, or as many as are free
+    do
+    {
+        head = r->prodHead;
+        nfree = r->size + r->consTail - head;
+        if(n > nfree)
+        {
+            n = nfree;
+        }
+        if(n == 0)
+        {
+            return 0;
+        }
+        next = head + n;
+        if(r->flags & RING_SP_ENQ)
+        {
+            r->prodHead = next;
+            break;
+        }
+    } while(cmpxchg((uint32_t *)&(r->prodHead), head, next) != head);
+
+    // 2. fill them
+    for(int i = 0; i < n; i++)
+    {
+        r->slots[(head + i) & r->mask] = objs[i];
+    }
+    asm volatile("" : : : "memory");
+
+    // 3. publish in order, after producers reserved before us
+    if(!(r->flags & RING_SP_ENQ))
+    {
+        while(r->prodTail != head)
+        {
+            cpuRelax();
+        }
+    }
+    r->prodTail = next;
+    return n;
+}
+
+int ringDequeueBurst(struct ring *r, void **objs, int n)
+{
+    uint32_t head, next, nused;
+
+    // 1. reserve n objects, or as many as there are
+    do
+    {
+        head = r->consHead;
+        nused = r->prodTail - head;
+        if(n > nused)
+        {
+            n = nused;
+        }
+        if(n == 0)
+        {
+            return 0;
+        }
+        next = head + n;
+        if(r->flags & RING_SC_DEQ)
+        {
+            r->consHead = next;
+            break;
+        }
+    } while(cmpxchg((uint32_t *)&(r->consHead), head, next) != head);
+
+    // 2. copy them out
+    for(int i = 0; i < n; i++)
+    {
+        objs[i] = r->slots[(head + i) & r->mask];
+    }
+    asm volatile("" : : : "memory");
+
+    // 3. free slots in order, after consumers reserved before us
+    if(!(r->flags & RING_SC_DEQ))
+    {
+        while(r->consTail != head)
+        {
+            cpuRelax();
+        }
+    }
+    r->consTail = next;
+    return n;
+}
+
+int ringEnqueue(struct ring *r, void *obj)
+{
+    return ringEnqueueBurst(r, &obj, 1) == 1 ? 0 : -1;
+}
+
+int ringDequeue(struct ring *r, void **obj)
+{
+    return ringDequeueBurst(r, obj, 1) == 1 ? 0 : -1;
+}
+
+uint32_t ringCount(struct ring *r)
+{
+    return r->prodTail - r->consTail;
+}
+
+int ringEmpty(struct ring *r)
+{
+    return r->prodTail == r->consHead;
+}
+
+#define RTEST_SIZE 16
+#define RTEST_NPROD 2
+#define RTEST_PER_PROD 1000
+
+struct ring rtRing;
+void *rtSlots[RTEST_SIZE];
+
+void rtProducer(void *arg)
+{
+    uint32_t base = (uint32_t)arg;
+    for(uint32_t i = 1; i <= RTEST_PER_PROD; i++)
+    {
+        while(ringEnqueue(&rtRing, (void *)(base + i)) != 0)
+        {
+            thrYeild();
+        }
+    }
+}
+
+// rtConsumer: body of ringTest, it yields to the producers and
+// joins them, so it needs a thread of its own
+void rtConsumer(void *arg)
+{
+    void *objs[RTEST_SIZE * 2];
+
+    // single producer single consumer, bulk, wraps around
+    ringInit(&rtRing, rtSlots, RTEST_SIZE, RING_SP_ENQ | RING_SC_DEQ);
+    for(int round = 0; round < 3; round++)
+    {
+        for(int i = 0; i < RTEST_SIZE * 2; i++)
+        {
+            objs[i] = (void *)i;
+        }
+        int in = ringEnqueueBurst(&rtRing, objs, RTEST_SIZE * 2);
+        int out = ringDequeueBurst(&rtRing, objs, RTEST_SIZE * 2);
+        int ok = (in == RTEST_SIZE && out == RTEST_SIZE);
+        for(int i = 0; i < out; i++)
+        {
+            ok = ok && (objs[i] == (void *)i);
+        }
+        printf("ring spsc round %d: in %d, out %d, %s\n", round, in, out, ok ? "ok" : "FAIL");
+    }
+
+    // two producer threads, consumer sums what it gets
+    ringInit(&rtRing, rtSlots, RTEST_SIZE, 0);
+    tid_t prod[RTEST_NPROD];
+    for(int p = 0; p < RTEST_NPROD; p++)
+    {
+        prod[p] = thrCreate(rtProducer, (void *)(p * 0x10000));
+    }
+
+    uint32_t sum = 0, got = 0;
+    while(got < RTEST_NPROD * RTEST_PER_PROD)
+    {
+        int n = ringDequeueBurst(&rtRing, objs, 4);
+        for(int i = 0; i < n; i++)
+        {
+            sum += (uint32_t)objs[i];
+        }
+        got += n;
+        if(n == 0)
+        {
+            thrYeild();
+        }
+    }
+    for(int p = 0; p < RTEST_NPROD; p++)
+    {
+        thrJoin(prod[p]);
+    }
+
+    uint32_t expect = 0;
+    for(int p = 0; p < RTEST_NPROD; p++)
+    {
+        expect += p * 0x10000 * RTEST_PER_PROD + RTEST_PER_PROD * (RTEST_PER_PROD + 1) / 2;
+    }
+    printf("ring mpmc: got %d, sum %x, expect %x\n", got, sum, expect);
+}
+
+void ringTest()
+{
+    // called from kernelMain before threads are scheduled
+    thrDetach(thrCreate(rtConsumer, NULL));
+}
@@ -0,0 +1,80 @@
+#ifndef _RING_H
+#define _RING_H
+
+#include "types.h"
+
+// lock-free ring buffer of pointers
+// producers reserve slots by moving prodHead, fill them, then
+// publish by moving prodTail, in reservation order. consumers
+// do the same with consHead and consTail. with RING_SP_ENQ
+// or RING_SC_DEQ that side has one user and head moves with a
+// plain store, otherwise with cmpxchg. size must be power of two
+//
+// a multi-producer (or consumer) waits for the ones which
+// reserved before it to publish, so don't use that side from
+// interrupt context and from threads on the same ring
+
+#define RING_SP_ENQ 0x1 // single producer
+#define RING_SC_DEQ 0x2 // single consumer
+
+struct ring
+{
+    uint32_t size;               // slots, power of two
+    uint32_t mask;               // size - 1
+    int flags;                   // RING_SP_ENQ, RING_SC_DEQ
+    volatile uint32_t prodHead;  // reserved by producers
+    volatile uint32_t prodTail;  // visible to consumers
+    volatile uint32_t consHead;  // reserved by consumers
+    volatile uint32_t consTail;  // free for producers
+    void **slots;                // storage, size entries
+};
+
+// ringInit: initialize ring on caller's storage
+// parameters: r-ring
+//             slots-array of size pointers
+//             size-number of slots, power of two
+//             flags-RING_SP_ENQ, RING_SC_DEQ or 0 for MPMC
+// outputs   : 0-success, -1-size is not power of two
+int ringInit(struct ring *r, void **slots, uint32_t size, int flags);
+
+// ringEnqueueBurst: put up to n objects, as many as fit
+// parameters: r-ring
+//             objs-objects
+//             n-number of objects
+// outputs   : number of objects put
+int ringEnqueueBurst(struct ring *r, void **objs, int n);
+
+// ringDequeueBurst: take up to n objects, as many as there are
+// parameters: r-ring
+//             objs-out param, objects
+//             n-max number of objects
+// outputs   : number of objects taken
+int ringDequeueBurst(struct ring *r, void **objs, int n);
+
+// ringEnqueue: put one object
+// parameters: r-ring
+//             obj-object
+// outputs   : 0-success, -1-ring is full
+int ringEnqueue(struct ring *r, void *obj);
+
+// ringDequeue: take one object
+// parameters: r-ring
+//             obj-out param, object
+// outputs   : 0-success, -1-ring is empty
+int ringDequeue(struct ring *r, void **obj);
+
+// ringCount: number of objects in ring, a snapshot
+// parameters: r-ring
+// outputs   : count
+uint32_t ringCount(struct ring *r);
+
+// ringEmpty: if ring has no object, a snapshot
+// parameters: r-ring
+// outputs   : 1-empty, 0-not empty
+int ringEmpty(struct ring *r);
+
+// Test: ring test, runs in a thread of its own since the
+//       consumer yields to producer threads and joins them
+void ringTest();
+
+#endif // _RING_H
@@ -0,0 +1,162 @@
+#include "softirq.h"
+#include "thread.h"
+
+void bhInit()
+{
+    for(int i = 0; i < IDTSIZE / 32; i++)
+    {
+        bhPending[i] = 0;
+    }
+    for(int i = 0; i < IDTSIZE; i++)
+    {
+        bhTable[i] = NULL;
+    }
+    for(int i = 0; i < NBHACTION; i++)
+    {
+        bhActions[i].handler = NULL;
+        bhActions[i].next = NULL;
+    }
+    bhRunning = 0;
+    spinlockInit(&bhLock);
+
+    thrDetach(thrCreate(bhDaemon, NULL));
+}
+
+int bhRegister(int vector, void (*handler)())
+{
+    uint32_t eflags = readEflags();
+    cli();
+
+    // one driver with several devices on the line registers
+    // its bottom half once
+    struct bhAction **pp = &(bhTable[vector]);
+    while(*pp != NULL)
+    {
+        if((*pp)->handler == handler)
+        {
+            if(eflags & FL_IF)
+            {
+                sti();
+            }
+            return 0;
+        }
+        pp = &((*pp)->next);
+    }
+
+    struct bhAction *act = NULL;
+    for(int i = 0; i < NBHACTION; i++)
+    {
+        if(bhActions[i].handler == NULL)
+        {
+            act = &(bhActions[i]);
+            break;
+        }
+    }
+    if(act != NULL)
+    {
+        act->handler = handler;
+        act->next = NULL;
+        *pp = act;
+    }
+
+    if(eflags & FL_IF)
+    {
+        sti();
+    }
+    if(act == NULL)
+    {
+        printf("[Error] bhRegister: no free bhAction\n");
+        return -1;
+    }
+    return 0;
+}
+
+void bhRaise(int vector)
+{
+    // other CPUs raise and take bits at the same time
+    uint32_t *p = &(bhPending[vector / 32]);
+    uint32_t bit = 1 << (vector % 32);
+    uint32_t old;
+    do
+    {
+        old = *(volatile uint32_t *)p;
+    } while(cmpxchg(p, old, old | bit) != old);
+}
+
+// bhAnyPending: if any bottom half is pending
+int bhAnyPending()
+{
+    for(int i = 0; i < IDTSIZE / 32; i++)
+    {
+        if(((volatile uint32_t *)bhPending)[i] != 0)
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+void bhRun()
+{
+    uint32_t pending[IDTSIZE / 32];
+
+    // an interrupt came while bottom halves are running,
+    // here or on another CPU, the running bhRun will see its
+    // bit. one CPU at a time keeps a driver's done ring with
+    // a single consumer
+    if(cmpxchg(&bhRunning, 0, 1) != 0)
+    {
+        return ;
+    }
+
+    for(int round = 0; round < BH_MAX_RESTART && bhAnyPending(); round++)
+    {
+        // 1. take pending bits, no raise is lost between
+        //    the read and the clear
+        for(int i = 0; i < IDTSIZE / 32; i++)
+        {
+            pending[i] = xchg(&(bhPending[i]), 0);
+        }
+
+        // 2. run handlers with interrupts on
+        sti();
+        for(int i = 0; i < IDTSIZE / 32; i++)
+        {
+            while(pending[i] != 0)
+            {
+                int bit = __builtin_ctz(pending[i]);
+                pending[i] &= ~(1 << bit);
+                for(struct bhAction *act = bhTable[i * 32 + bit]; act != NULL; act = act->next)
+                {
+                    act->handler();
+                }
+            }
+        }
+        cli();
+    }
+
+    // a bit raised by another CPU after the last round is
+    // seen below, since bhRunning is cleared first
+    xchg(&bhRunning, 0);
+
+    // interrupts keep coming, leave the rest to bhDaemon
+    // instead of starving the interrupted thread
+    if(bhAnyPending())
+    {
+        thrCondSignal(bhPending);
+    }
+}
+
+void bhDaemon(void *arg)
+{
+    for(;;)
+    {
+        spinlockLock(&bhLock);
+        while(!bhAnyPending())
+        {
+            thrCondWait(bhPending, &bhLock);
+        }
+        bhRun();
+        spinlockUnlock(&bhLock);
+    }
+}
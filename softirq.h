@@ -0,0 +1,67 @@
+#ifndef _SOFTIRQ_H
+#define _SOFTIRQ_H
+
+#include "types.h"
+#include "idt.h"
+#include "concurrency.h"
+
+// deferred interrupt processing (bottom half)
+// an interrupt handler (top half) runs with interrupts off and
+// does only what can't wait: ack the device, grab its data. it
+// then raises the bottom half of its vector, which runs later
+// with interrupts on, either when the outermost interrupt exits
+// or in the bottom half thread when there is too much to do
+
+#define BH_MAX_RESTART 10 // rounds on interrupt exit before
+                          // handing over to bhDaemon
+
+// pending bits, one per vector, set by cmpxchg and taken by
+// xchg from any CPU
+uint32_t bhPending[IDTSIZE / 32];
+// bottom half handlers, chained like irqActions: drivers which
+// share an interrupt line each keep their bottom half
+struct bhAction
+{
+    void (*handler)();     // NULL if the action is free
+    struct bhAction *next; // next bottom half of the vector
+};
+
+#define NBHACTION 32
+struct bhAction bhActions[NBHACTION];
+struct bhAction *bhTable[IDTSIZE];
+// bottom halves are being run on some CPU, don't reenter,
+// taken by cmpxchg
+uint32_t bhRunning;
+spinlock_t bhLock;
+
+// bhInit: initialize bottom halves and start bottom half thread
+// parameters: void
+// outputs   : void
+void bhInit();
+
+// bhRegister: chain bottom half on vector, once for each
+//             handler, all of them run when the vector is raised
+// parameters: vector-interrupt vector
+//             handler-bottom half handler
+// outputs   : 0-success, -1-no free bhAction
+int bhRegister(int vector, void (*handler)());
+
+// bhRaise: mark bottom half of vector pending, called by top
+//          half with interrupts off
+// parameters: vector-interrupt vector
+// outputs   : void
+void bhRaise(int vector);
+
+// bhRun: run pending bottom halves with interrupts on, called
+//        with interrupts off, and return with interrupts off
+// parameters: void
+// outputs   : void
+void bhRun();
+
+// bhDaemon: bottom half thread, run bottom halves left over
+//           by bhRun
+// parameters: arg-unused
+// outputs   : void
+void bhDaemon(void *arg);
+
+#endif // _SOFTIRQ_H
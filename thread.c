@@ -1,8 +1,11 @@
 #include "thread.h"
 #include "memory.h"
 #include "gdt.h"
+#include "util.h"
+#include "rcu.h"
 
 int globalTestVar = 0;
+int nextCpu; // cpu for next new thread
 
 extern void trapret();
 extern void thread_entry();
@@ -29,8 +32,10 @@ void waitloops(int n)
 
 void kernStub(void (*func)(void *), void *args)
 {
+    // scheduler switches with interrupts off
+    sti();
     func(args);
-    thrExit();
+    thrExit(0);
 }
 
 thread_t *thrAlloc()
@@ -38,7 +43,10 @@ thread_t *thrAlloc()
     thread_t *t = NULL;
     for(int i = 0; i < THRQUESIZE; i++)
     {
-        if(thrqueue[i].status == THR_UNUSED || thrqueue[i].status == THR_STOP)
+        // a finished thread is still on its kernel stack until
+        // the scheduler of its cpu has switched off it
+        if((thrqueue[i].status == THR_UNUSED || thrqueue[i].status == THR_STOP) &&
+           !thrqueue[i].onCpu)
         {
             t = &(thrqueue[i]);
             break;
@@ -47,11 +55,8 @@ thread_t *thrAlloc()
     return t;
 }
 
-tid_t thrCreate(void (*thrFunc)(void *), void *args)
+void thrSetup(thread_t *t, void (*thrFunc)(void *), void *args)
 {
-    thread_t *t = thrAlloc();
-    if(t == NULL) return -1;
-
     char *sp = t->kstack + KSTACKSIZE;
     sp -= sizeof(struct trapframe);
     t->tf = (struct trapframe *)sp;
@@ -71,12 +76,291 @@ tid_t thrCreate(void (*thrFunc)(void *), void *args)
     memset(t->ctx, 0, sizeof(struct context));
     t->ctx->eip = thread_entry;
 
-    t->status = THR_READY;
+    t->cv = NULL;
+    t->exitCode = 0;
+    t->detached = 0;
+    t->rcuNest = 0;
+    t->prio = PRIO_NORMAL;
+    t->effPrio = PRIO_NORMAL;
+    t->waitMtx = NULL;
     t->counter = DEFAULT_COUNTER;
+}
+
+tid_t thrCreate(void (*thrFunc)(void *), void *args)
+{
+    // reserve a slot, other cpus may be allocating too
+    spinlockLock(&thrque_lock);
+    thread_t *t = thrAlloc();
+    if(t != NULL)
+    {
+        t->status = THR_NEW;
+    }
+    spinlockUnlock(&thrque_lock);
+    if(t == NULL) return -1;
+
+    thrSetup(t, thrFunc, args);
+
+    // spread new threads over cpus
+    t->cpu = xadd((uint32_t *)&nextCpu, 1) % ncpu;
+    thrReady(t);
 
     return t->tid;
 }
 
+void rqInit(struct runqueue *rq)
+{
+    for(int p = 0; p < NPRIO; p++)
+    {
+        rq->q[p].head = 0;
+        rq->q[p].tail = 0;
+        rq->q[p].len = 0;
+    }
+    rq->bitmap = 0;
+    rq->len = 0;
+    spinlockInit(&(rq->lock));
+}
+
+// rqInsert: queue t at its effective priority, with rq->lock
+void rqInsert(struct runqueue *rq, thread_t *t)
+{
+    struct rqlist *l = &(rq->q[t->effPrio]);
+    l->thrs[l->tail] = t;
+    l->tail = (l->tail + 1) % RQSIZE;
+    l->len++;
+    t->rqPrio = t->effPrio;
+    rq->bitmap |= 1 << t->effPrio;
+    rq->len++;
+}
+
+// rqTop: highest non-empty priority, -1 if rq is empty
+int rqTop(struct runqueue *rq)
+{
+    for(int p = NPRIO - 1; p >= 0; p--)
+    {
+        if(rq->bitmap & (1 << p))
+        {
+            return p;
+        }
+    }
+    return -1;
+}
+
+void rqPush(struct runqueue *rq, thread_t *t)
+{
+    uint32_t eflags = spinlockLockSave(&(rq->lock));
+    rqInsert(rq, t);
+    spinlockUnlockRestore(&(rq->lock), eflags);
+}
+
+thread_t *rqPop(struct runqueue *rq)
+{
+    thread_t *t = NULL;
+    uint32_t eflags = spinlockLockSave(&(rq->lock));
+    int p = rqTop(rq);
+    if(p >= 0)
+    {
+        struct rqlist *l = &(rq->q[p]);
+        t = l->thrs[l->head];
+        l->head = (l->head + 1) % RQSIZE;
+        if(--l->len == 0)
+        {
+            rq->bitmap &= ~(1 << p);
+        }
+        rq->len--;
+    }
+    spinlockUnlockRestore(&(rq->lock), eflags);
+    return t;
+}
+
+int rqRemove(struct runqueue *rq, thread_t *t)
+{
+    struct rqlist *l = &(rq->q[t->rqPrio]);
+    for(int i = 0; i < l->len; i++)
+    {
+        int idx = (l->head + i) % RQSIZE;
+        if(l->thrs[idx] != t)
+        {
+            continue;
+        }
+
+        // close the gap, later ones move forward
+        for(int j = i; j < l->len - 1; j++)
+        {
+            l->thrs[(l->head + j) % RQSIZE] = l->thrs[(l->head + j + 1) % RQSIZE];
+        }
+        l->tail = (l->tail + RQSIZE - 1) % RQSIZE;
+        if(--l->len == 0)
+        {
+            rq->bitmap &= ~(1 << t->rqPrio);
+        }
+        rq->len--;
+        return 1;
+    }
+    return 0;
+}
+
+int rqSteal(struct runqueue *rq, thread_t **thrs, int n)
+{
+    int got = 0, p;
+    uint32_t eflags = spinlockLockSave(&(rq->lock));
+    while(got < n && (p = rqTop(rq)) >= 0)
+    {
+        struct rqlist *l = &(rq->q[p]);
+        l->tail = (l->tail + RQSIZE - 1) % RQSIZE;
+        thrs[got++] = l->thrs[l->tail];
+        if(--l->len == 0)
+        {
+            rq->bitmap &= ~(1 << p);
+        }
+        rq->len--;
+    }
+    spinlockUnlockRestore(&(rq->lock), eflags);
+    return got;
+}
+
+thread_t *thrSteal(struct cpu *c)
+{
+    thread_t *thrs[RQ_STEAL_MAX];
+    struct cpu *victim = NULL;
+    int maxlen = 0;
+
+    // 1. busiest cpu, by published queue length
+    for(int i = 0; i < ncpu; i++)
+    {
+        if(&(cpus[i]) != c && cpus[i].rq.len > maxlen)
+        {
+            victim = &(cpus[i]);
+            maxlen = cpus[i].rq.len;
+        }
+    }
+    if(victim == NULL)
+    {
+        return NULL;
+    }
+
+    // 2. take half of its queue, it keeps running its
+    //    current thread and the rest
+    int n = maxlen / 2;
+    if(n < 1)
+    {
+        n = 1;
+    }
+    if(n > RQ_STEAL_MAX)
+    {
+        n = RQ_STEAL_MAX;
+    }
+    n = rqSteal(&(victim->rq), thrs, n);
+    if(n == 0)
+    {
+        return NULL;
+    }
+
+    // 3. keep the rest on our own queue
+    for(int i = 1; i < n; i++)
+    {
+        thrs[i]->cpu = c->id;
+        rqPush(&(c->rq), thrs[i]);
+    }
+    thrs[0]->cpu = c->id;
+    return thrs[0];
+}
+
+void thrReady(thread_t *t)
+{
+    struct cpu *c = &(cpus[t->cpu]);
+    t->status = THR_READY;
+    rqPush(&(c->rq), t);
+
+    // preempt a lower priority thread on its next interrupt
+    thread_t *cur = c->current;
+    if(cur != NULL && cur != c->idle && cur->effPrio < t->effPrio)
+    {
+        c->resched = 1;
+    }
+}
+
+void thrSetEffPrio(thread_t *t, int prio)
+{
+    if(t->effPrio == prio)
+    {
+        return ;
+    }
+
+    struct runqueue *rq = &(cpus[t->cpu].rq);
+    uint32_t eflags = spinlockLockSave(&(rq->lock));
+    int queued = (t->status == THR_READY) && rqRemove(rq, t);
+    t->effPrio = prio;
+    if(queued)
+    {
+        rqInsert(rq, t);
+    }
+    spinlockUnlockRestore(&(rq->lock), eflags);
+}
+
+// thrInheritedPrio: base priority of t, raised to its highest
+// waiter on the mutexes it holds
+int thrInheritedPrio(thread_t *t)
+{
+    int prio = t->prio;
+    for(int i = 1; i < THRQUESIZE; i++)
+    {
+        thread_t *w = &(thrqueue[i]);
+        if(w->status == THR_SLEEPING && w->waitMtx != NULL &&
+           w->waitMtx->owner == t && w->effPrio > prio)
+        {
+            prio = w->effPrio;
+        }
+    }
+    return prio;
+}
+
+int thrSetPrio(tid_t tid, int prio)
+{
+    if(tid <= 0 || tid >= THRQUESIZE || prio < PRIO_LOW || prio >= NPRIO)
+    {
+        return -1;
+    }
+
+    thread_t *t = &(thrqueue[tid]);
+    if(t->status == THR_UNUSED)
+    {
+        return -1;
+    }
+    t->prio = prio;
+    thrSetEffPrio(t, thrInheritedPrio(t));
+    return 0;
+}
+
+void thrIdle(void *arg)
+{
+    for(;;)
+    {
+        sti();
+        asm volatile("hlt");
+    }
+}
+
+void thrCpuInit(struct cpu *c)
+{
+    // scheduler runs on its own stack, it starts at thrSched
+    c->scheduler = &(schedThrs[c->id]);
+    c->scheduler->tid = -1;
+    char *sp = c->scheduler->kstack + KSTACKSIZE;
+    sp -= sizeof(struct context);
+    c->scheduler->ctx = (struct context *)sp;
+    memset(c->scheduler->ctx, 0, sizeof(struct context));
+    c->scheduler->ctx->eip = thrSched;
+
+    // idle thread is never queued, scheduler picks it
+    // when run queue is empty
+    c->idle = &(idleThrs[c->id]);
+    c->idle->tid = -1;
+    thrSetup(c->idle, thrIdle, NULL);
+    c->idle->cpu = c->id;
+
+    rqInit(&(c->rq));
+}
+
 void thrInit()
 {
     asm volatile("cli");
@@ -86,41 +370,86 @@ void thrInit()
         thrqueue[i].tid = i;
         thrqueue[i].status = THR_UNUSED;
     }
-    char *sp = thr_scheduler->kstack + KSTACKSIZE;
-    sp -= sizeof(struct context);
-    thr_scheduler->ctx = (struct context *)sp;
-    memset(thr_scheduler->ctx, 0, sizeof(struct context));
-    thr_scheduler->ctx->eip = thrSched;
+    nextCpu = 0;
+    nrSwitch = pcounterAlloc();
+    thrCpuInit(mycpu());
     
     asm volatile("sti");
 }
 
 void thrSched()
 {
+    struct cpu *c = mycpu();
     struct thread *t;
     for(;;)
     {
-        int maxp = 0;
-        for(int i = 0; i < THRQUESIZE; i++)
+        cli();
+        t = rqPop(&(c->rq));
+        if(t == NULL)
         {
-            if(thrqueue[i].status == THR_READY && thrqueue[i].counter > maxp)
-            {
-                t = &(thrqueue[i]);
-                maxp = thrqueue[i].counter;
-            }
+            // nothing of our own, help the busiest cpu
+            t = thrSteal(c);
+        }
+        if(t == NULL)
+        {
+            t = c->idle;
+        }
+        else if(t->status != THR_READY)
+        {
+            // killed while queued
+            continue;
         }
 
-        thr_current = t;
-        thr_current->status = THR_RUNNING;
-        ctxSwitch(&(thr_scheduler->ctx), thr_current->ctx);
+        // a thread queued by yield or wakeup on another cpu
+        // may still be switching out there
+        while(t->onCpu)
+        {
+            cpuRelax();
+        }
+
+        c->current = t;
+        t->cpu = c->id;
+        t->onCpu = 1;
+        t->status = THR_RUNNING;
+        pcounterInc(nrSwitch);
+        ctxSwitch(&(c->scheduler->ctx), t->ctx);
+        // t's context is saved, other cpus may run it now
+        asm volatile("" : : : "memory");
+        t->onCpu = 0;
+        c->current = NULL;
+        // no reader runs on this cpu now
+        rcuQs(c);
     }
 }
 
+void thrSchedStart()
+{
+    // boot context is never switched back to
+    struct context *boot;
+    cli();
+    ctxSwitch(&boot, thr_scheduler->ctx);
+}
+
 void thrYeild()
 {
-    thr_current->status = THR_READY;
-    thr_current->counter--;
-    ctxSwitch(&(thr_current->ctx), thr_scheduler->ctx);
+    thread_t *t = thr_current;
+    if(t == NULL)
+    {
+        return ;
+    }
+
+    uint32_t eflags = readEflags();
+    cli();
+    t->counter--;
+    if(t != mycpu()->idle)
+    {
+        thrReady(t);
+    }
+    ctxSwitch(&(t->ctx), thr_scheduler->ctx);
+    if(eflags & FL_IF)
+    {
+        sti();
+    }
 }
 
 thread_t *getCurThread()
@@ -133,20 +462,104 @@ tid_t thrGettid()
     return thr_current->tid; 
 }
 
-void thrJoin(tid_t tid)
+int thrJoin(tid_t tid)
+{
+    if(tid >= THRQUESIZE)
+    {
+        return -1;
+    }
+
+    thread_t *t = &(thrqueue[tid]);
+    if(t == thr_current || t->detached ||
+       t->status == THR_UNUSED || t->status == THR_STOP)
+    {
+        return -1;
+    }
+
+    spinlockLock(&thrque_lock);
+    while(t->status != THR_ZOMBIE)
+    {
+        // reaped by another joiner, or detached while we wait
+        if(t->status == THR_STOP || t->detached)
+        {
+            spinlockUnlock(&thrque_lock);
+            return -1;
+        }
+        thrCondWait(t, &thrque_lock);
+    }
+    int code = t->exitCode;
+    // reap, the slot can be allocated again once t is off
+    // its cpu
+    t->status = THR_STOP;
+    spinlockUnlock(&thrque_lock);
+
+    // t may still be switching out, it needs no thrque_lock
+    // for that
+    while(t->onCpu)
+    {
+        cpuRelax();
+    }
+    return code;
+}
+
+int thrDetach(tid_t tid)
 {
+    if(tid >= THRQUESIZE)
+    {
+        return -1;
+    }
+
+    thread_t *t = &(thrqueue[tid]);
+    spinlockLock(&thrque_lock);
+    if(t->status == THR_UNUSED || t->status == THR_STOP)
+    {
+        spinlockUnlock(&thrque_lock);
+        return -1;
+    }
+    t->detached = 1;
+    if(t->status == THR_ZOMBIE)
+    {
+        t->status = THR_STOP;
+    }
+    spinlockUnlock(&thrque_lock);
 
+    // joiners already asleep give up
+    thrCondBroadcast(t);
+    return 0;
 }
 
-void thrExit()
+// thrFinish: mark t as finished, a detached thread is reaped
+//            directly, otherwise it stays zombie until joined
+void thrFinish(thread_t *t, int code)
 {
-    thr_current->status = THR_ZOMBIE;
+    t->exitCode = code;
+    if(t->detached)
+    {
+        t->status = THR_STOP;
+    }
+    else
+    {
+        t->status = THR_ZOMBIE;
+    }
+    // a joiner which came before thrDetach sees THR_STOP
+    thrCondBroadcast(t);
+}
+
+void thrExit(int code)
+{
+    // no one on this cpu may take the slot before we switch
+    // off its kernel stack, thrAlloc keeps other cpus off it
+    // while onCpu is set
+    cli();
+    thrFinish(thr_current, code);
     ctxSwitch(&(thr_current->ctx), thr_scheduler->ctx);
 }
 
 void thrKill(tid_t tid)
 {
-    thrqueue[tid].status = THR_ZOMBIE;
+    cli();
+    thrFinish(&(thrqueue[tid]), -1);
+    sti();
 }
 
 void func(void *args)
@@ -182,14 +595,20 @@ void thrCondWait(void *cv, spinlock_t *spl)
 {
     if(spl != &thrque_lock)
     {
+        // interrupts stay off, a waker in an interrupt handler
+        // would spin on thrque_lock held here
         spinlockLock(&thrque_lock);
-        spinlockUnlock(spl);
+        spinlockUnlockRestore(spl, 0);
     }
 
     thread_t *t = getCurThread();
     t->cv = cv;
     t->status = THR_SLEEPING;
-    thrSched();
+    // switch to scheduler, drop thrque_lock while sleeping
+    // so that the waker can take it
+    thrque_lock.lock = 0;
+    ctxSwitch(&(t->ctx), thr_scheduler->ctx);
+    while(xchg(&(thrque_lock.lock), 1) != 0);
     t->cv = (void *)NULL;
 
     if(spl != &thrque_lock)
@@ -199,27 +618,56 @@ void thrCondWait(void *cv, spinlock_t *spl)
     }
 }
 
+// wakers scan and change sleepers with thrque_lock, the lock
+// sleepers hold from THR_SLEEPING until they are switched out,
+// so two wakers never ready one thread twice. they may run in
+// interrupt handlers, keep IF as it is
 void thrCondSignal(void *cv)
 {
+    uint32_t eflags = spinlockLockSave(&thrque_lock);
     for(int i = 1; i < THRQUESIZE; i++)
     {
         if(thrqueue[i].status == THR_SLEEPING && thrqueue[i].cv == cv)
         {
-            thrqueue[i].status = THR_READY;
+            thrReady(&(thrqueue[i]));
             break;
         }
     }
+    spinlockUnlockRestore(&thrque_lock, eflags);
+}
+
+void thrCondSignalPrio(void *cv)
+{
+    uint32_t eflags = spinlockLockSave(&thrque_lock);
+    thread_t *top = NULL;
+    for(int i = 1; i < THRQUESIZE; i++)
+    {
+        thread_t *t = &(thrqueue[i]);
+        if(t->status == THR_SLEEPING && t->cv == cv &&
+           (top == NULL || t->effPrio > top->effPrio))
+        {
+            top = t;
+        }
+    }
+
+    if(top != NULL)
+    {
+        thrReady(top);
+    }
+    spinlockUnlockRestore(&thrque_lock, eflags);
 }
 
 void thrCondBroadcast(void *cv)
 {
+    uint32_t eflags = spinlockLockSave(&thrque_lock);
     for(int i = 1; i < THRQUESIZE; i++)
     {
         if(thrqueue[i].status == THR_SLEEPING && thrqueue[i].cv == cv)
         {
-            thrqueue[i].status = THR_READY;
+            thrReady(&(thrqueue[i]));
         }
     }
+    spinlockUnlockRestore(&thrque_lock, eflags);
 }
 
 void gfunc0(void *arg)
@@ -230,7 +678,7 @@ void gfunc0(void *arg)
     globalTestVar += 10;
     spinlockUnlock(&gtLock);
     thrCondSignal(&globalTestVar);
-    thrExit();
+    thrExit(0);
 }
 
 void gfunc1(void *arg)
@@ -242,7 +690,7 @@ void gfunc1(void *arg)
     }
     printf("gfunc: %d\n", globalTestVar);
     spinlockUnlock(&gtLock);
-    thrExit();
+    thrExit(0);
 }
 
 void cvTest()
@@ -253,29 +701,129 @@ void cvTest()
     tid_t t1 = thrCreate(gfunc1, NULL);
 }
 
+void jfunc(void *arg)
+{
+    waitloops(1000000);
+    thrExit((int)arg);
+}
+
+// joinThread: body of joinTest, thrJoin sleeps so it needs a
+// thread of its own
+void joinThread(void *arg)
+{
+    tid_t t0 = thrCreate(jfunc, (void *)7);
+    tid_t t1 = thrCreate(jfunc, (void *)9);
+    printf("join %d: %d\n", t0, thrJoin(t0));
+    printf("join %d: %d\n", t1, thrJoin(t1));
+
+    // detached threads are reaped without join
+    tid_t t2 = thrCreate(jfunc, NULL);
+    thrDetach(t2);
+}
+
+void joinTest()
+{
+    // called from kernelMain before threads are scheduled
+    thrDetach(thrCreate(joinThread, NULL));
+}
+
 void thrMutexInit(mutex_t *m)
 {
     m->lock = 0;
+    m->owner = NULL;
+    m->waiters = 0;
     spinlockInit(&(m->lk));
 }
 
+int thrMutexTryLock(mutex_t *m)
+{
+    if(cmpxchg(&(m->lock), 0, 1) == 0)
+    {
+        m->owner = thr_current;
+        return 1;
+    }
+    return 0;
+}
+
+// thrMutexInherit: lend prio to the owner of m, and on to the
+// owner of the mutex it sleeps on, and so on
+void thrMutexInherit(mutex_t *m, int prio)
+{
+    for(int depth = 0; m != NULL && depth < PI_MAX_DEPTH; depth++)
+    {
+        thread_t *owner = m->owner;
+        if(owner == NULL || owner->effPrio >= prio)
+        {
+            break;
+        }
+        thrSetEffPrio(owner, prio);
+        m = owner->waitMtx;
+    }
+}
+
 void thrMutexLock(mutex_t *m)
 {
+    // 1. fast path, mutex is free
+    if(thrMutexTryLock(m))
+    {
+        return ;
+    }
+
+    // 2. spin while the owner is running, it is likely
+    //    to release the mutex before a context switch
+    //    would even complete
+    for(int spin = 0; spin < MTX_SPIN_LIMIT; spin++)
+    {
+        thread_t *owner = m->owner;
+        if(owner != NULL && owner->status != THR_RUNNING)
+        {
+            break;
+        }
+        if(m->lock == 0 && thrMutexTryLock(m))
+        {
+            return ;
+        }
+        cpuRelax();
+    }
+
+    // 3. sleep until an unlocker wakes us up, waiters is
+    //    raised before retrying so that an unlock after
+    //    the failed cmpxchg always sees us
+    thread_t *cur = thr_current;
     spinlockLock(&(m->lk));
-    while(m->lock == 1)
+    m->waiters++;
+    cur->waitMtx = m;
+    while(!thrMutexTryLock(m))
     {
+        thrMutexInherit(m, cur->effPrio);
         thrCondWait(m, &(m->lk));
     }
-    m->lock = 1;
+    cur->waitMtx = NULL;
+    m->waiters--;
     spinlockUnlock(&(m->lk));
 }
 
 void thrMutexUnlock(mutex_t *m)
 {
-    spinlockLock(&(m->lk));
-    m->lock = 0;
-    thrCondBroadcast(m);
-    spinlockUnlock(&(m->lk));
+    thread_t *cur = thr_current;
+    m->owner = NULL;
+    xchg(&(m->lock), 0);
+
+    // hand off to exactly one sleeper, the most urgent one
+    if(m->waiters > 0)
+    {
+        spinlockLock(&(m->lk));
+        thrCondSignalPrio(m);
+        spinlockUnlock(&(m->lk));
+    }
+
+    // give back the priority lent through m, keep what
+    // waiters on other held mutexes lend
+    if(cur != NULL && cur->effPrio != cur->prio)
+    {
+        thrSetEffPrio(cur, thrInheritedPrio(cur));
+        needResched = 1;
+    }
 }
 
 void mfunc(void *arg)
@@ -300,6 +848,37 @@ void mtxTest()
     tid_t t1 = thrCreate(mfunc, NULL);
 }
 
+void piLow(void *arg)
+{
+    thrMutexLock(&pim);
+    // let piHigh run and block on pim
+    thrSemUp(&pisem);
+    for(int i = 0; i < 10; i++)
+    {
+        thrYeild();
+    }
+    printf("pi: low holds mutex, prio %d, effective %d\n",
+           thr_current->prio, thr_current->effPrio);
+    thrMutexUnlock(&pim);
+    printf("pi: low unlocked, effective %d\n", thr_current->effPrio);
+}
+
+void piHigh(void *arg)
+{
+    thrSemDown(&pisem);
+    thrMutexLock(&pim);
+    printf("pi: high got mutex\n");
+    thrMutexUnlock(&pim);
+}
+
+void piTest()
+{
+    thrMutexInit(&pim);
+    thrSemInit(&pisem, 0);
+    thrSetPrio(thrCreate(piLow, NULL), PRIO_LOW);
+    thrSetPrio(thrCreate(piHigh, NULL), PRIO_HIGH);
+}
+
 void thrSemInit(sem_t *s, int val)
 {
     s->count = val;
@@ -308,25 +887,21 @@ void thrSemInit(sem_t *s, int val)
 
 void thrSemDown(sem_t *s)
 {
+    spinlockLock(&(s->lk));
     while(s->count <= 0)
     {
-        getCurThread()->status = THR_SLEEPING;
-        getCurThread()->cv = s;
+        thrCondWait(s, &(s->lk));
     }
     s->count--;
+    spinlockUnlock(&(s->lk));
 }
 
 void thrSemUp(sem_t *s)
 {
+    spinlockLock(&(s->lk));
     s->count++;
-    for(int i = 0; i < THRQUESIZE; i++)
-    {
-        if(thrqueue[i].status == THR_SLEEPING && thrqueue[i].cv == s)
-        {
-            thrqueue[i].status = THR_READY;
-            thrqueue[i].cv = NULL;
-        }
-    }
+    thrCondSignal(s);
+    spinlockUnlock(&(s->lk));
 }
 
 void producer(void *arg)
@@ -338,7 +913,7 @@ void producer(void *arg)
         printf("slot %d: full\n", idx++);
         thrSemUp(&s_full);
     }
-    thrExit(); 
+    thrExit(0); 
 }
 
 void consumer(void *arg)
@@ -350,7 +925,7 @@ void consumer(void *arg)
         printf("slot %d: empty\n", idx);
         thrSemUp(&s_emp);
     }
-    thrExit();
+    thrExit(0);
 }
 
 void semTest()
@@ -362,3 +937,154 @@ void semTest()
     tid_t t1 = thrCreate(consumer, NULL);
 }
 
+void thrRwlockInit(rwlock_t *rw)
+{
+    rw->readers = 0;
+    rw->writer = 0;
+    rw->wwait = 0;
+    spinlockInit(&(rw->lk));
+}
+
+void thrRwlockRdLock(rwlock_t *rw)
+{
+    spinlockLock(&(rw->lk));
+    while(rw->writer || rw->wwait > 0)
+    {
+        thrCondWait(rw, &(rw->lk));
+    }
+    rw->readers++;
+    spinlockUnlock(&(rw->lk));
+}
+
+void thrRwlockRdUnlock(rwlock_t *rw)
+{
+    spinlockLock(&(rw->lk));
+    rw->readers--;
+    if(rw->readers == 0)
+    {
+        thrCondBroadcast(rw);
+    }
+    spinlockUnlock(&(rw->lk));
+}
+
+void thrRwlockWrLock(rwlock_t *rw)
+{
+    spinlockLock(&(rw->lk));
+    rw->wwait++;
+    while(rw->writer || rw->readers > 0)
+    {
+        thrCondWait(rw, &(rw->lk));
+    }
+    rw->wwait--;
+    rw->writer = 1;
+    spinlockUnlock(&(rw->lk));
+}
+
+void thrRwlockWrUnlock(rwlock_t *rw)
+{
+    spinlockLock(&(rw->lk));
+    rw->writer = 0;
+    thrCondBroadcast(rw);
+    spinlockUnlock(&(rw->lk));
+}
+
+// rdfunc: reader of grw, reads until the writer is done,
+// fails if a value goes back
+void rdfunc(void *arg)
+{
+    int last = 0, v;
+    do
+    {
+        thrRwlockRdLock(&grw);
+        v = globalTestVar;
+        thrRwlockRdUnlock(&grw);
+        if(v < last)
+        {
+            printf("reader %s: %d after %d\n", (char *)arg, v, last);
+            thrExit(-1);
+        }
+        last = v;
+        thrYeild();
+    } while(v != 123);
+    thrExit(0);
+}
+
+void wrfunc(void *arg)
+{
+    for(int i = 0; i < 100; i++)
+    {
+        thrRwlockWrLock(&grw);
+        globalTestVar++;
+        thrRwlockWrUnlock(&grw);
+    }
+    thrExit(0);
+}
+
+// rdspfunc: reader of grwsp, the pair must never be seen half
+// written
+void rdspfunc(void *arg)
+{
+    int a, b;
+    do
+    {
+        rwspinlockRdLock(&grwsp);
+        a = rwspA;
+        b = rwspB;
+        rwspinlockRdUnlock(&grwsp);
+        if(a != b)
+        {
+            printf("spin reader %s: torn %d %d\n", (char *)arg, a, b);
+            thrExit(-1);
+        }
+        thrYeild();
+    } while(a != 100);
+    thrExit(0);
+}
+
+void wrspfunc(void *arg)
+{
+    for(int i = 1; i <= 100; i++)
+    {
+        rwspinlockWrLock(&grwsp);
+        rwspA = i;
+        waitloops(1000);
+        rwspB = i;
+        rwspinlockWrUnlock(&grwsp);
+        thrYeild();
+    }
+    thrExit(0);
+}
+
+// rwThread: body of rwTest, two readers and a writer on each
+// lock, joined so it needs a thread of its own
+void rwThread(void *arg)
+{
+    thrRwlockInit(&grw);
+    globalTestVar = 23;
+    tid_t t0 = thrCreate(rdfunc, "A");
+    tid_t t1 = thrCreate(rdfunc, "B");
+    tid_t t2 = thrCreate(wrfunc, NULL);
+    int ra = thrJoin(t0);
+    int rb = thrJoin(t1);
+    int w = thrJoin(t2);
+    int ok = (ra == 0 && rb == 0 && w == 0 && globalTestVar == 123);
+    printf("rwlock: readers saw %d, %s\n", globalTestVar, ok ? "ok" : "FAIL");
+
+    rwspinlockInit(&grwsp);
+    rwspA = 0;
+    rwspB = 0;
+    t0 = thrCreate(rdspfunc, "A");
+    t1 = thrCreate(rdspfunc, "B");
+    t2 = thrCreate(wrspfunc, NULL);
+    ra = thrJoin(t0);
+    rb = thrJoin(t1);
+    w = thrJoin(t2);
+    ok = (ra == 0 && rb == 0 && w == 0 && rwspA == 100 && rwspB == 100);
+    printf("rwspinlock: %s\n", ok ? "ok" : "FAIL");
+}
+
+void rwTest()
+{
+    // called from kernelMain before threads are scheduled
+    thrDetach(thrCreate(rwThread, NULL));
+}
@@ -5,6 +5,8 @@
 #include "console.h"
 #include "idt.h"
 #include "concurrency.h"
+#include "cpu.h"
+#include "percpu.h"
 
 #define THRQUESIZE  256
 #define KSTACKSIZE 1024
@@ -15,6 +17,7 @@
 #define THR_SLEEPING 3
 #define THR_ZOMBIE   4
 #define THR_STOP     5
+#define THR_NEW      6 // allocated, being set up
 
 #define SCHED_RR    1  // Round Robin
 #define SCHED_FIFO  2  // FIFO
@@ -57,13 +60,40 @@ struct thread
     struct context *ctx;        // thread's context
     uint8_t kstack[KSTACKSIZE]; // kernel stack
     void *cv;                   // condition variable 
+    int exitCode;               // exit code, handed to thrJoin
+    int detached;               // reaped at exit, can't be joined
+    int cpu;                    // cpu whose run queue it is on
+    volatile int onCpu;         // context not saved yet, a thief
+                                // must wait before running it
+    int rcuNest;                // rcu read sections, no preemption
+    int prio;                   // base priority
+    int effPrio;                // prio raised by priority inheritance
+    int rqPrio;                 // list it is queued on, in run queue
+    struct mutex *waitMtx;      // mutex it sleeps on
 };
 
 typedef struct thread thread_t;
 
-thread_t *thr_scheduler, *thr_current;
+// thread priorities, higher runs first. a thread holding a
+// mutex runs at least at the priority of its highest waiter
+#define PRIO_LOW    0
+#define PRIO_NORMAL 1
+#define PRIO_HIGH   2
+#define PRIO_RT     3 // latency critical, such as I/O completion
+
+#define PI_MAX_DEPTH 8 // max mutex chain followed by inheritance
+
+// per-cpu: running thread, scheduler context, and if
+// timer asks to yield on interrupt exit
+#define thr_current   (mycpu()->current)
+#define thr_scheduler (mycpu()->scheduler)
+#define needResched   (mycpu()->resched)
+
+thread_t schedThrs[NCPU]; // scheduler context of each cpu
+thread_t idleThrs[NCPU];  // idle thread of each cpu
 spinlock_t thrque_lock;
 thread_t thrqueue[THRQUESIZE];
+pcounter_t nrSwitch; // context switches, per-cpu counter
 
 // thread_entry: thread entry point, defined by switch.s
 // parameters: void
@@ -93,12 +123,67 @@ thread_t *thrAlloc();
 // ouputs    : return tid of new thread 
 tid_t thrCreate(void thrFunc(void *), void *args);
 
+// thrSetup: build initial stack of t, to start at thrFunc
+// parameters: t-thread
+//             thrFunc-the start function of this thread
+//             args-argument of function
+// outputs   : void
+void thrSetup(thread_t *t, void (*thrFunc)(void *), void *args);
+
+// thrReady: mark t ready, put it on its cpu's run queue
+// parameters: t-thread
+// outputs   : void
+void thrReady(thread_t *t);
+
+// rqInit, rqPush, rqPop: per-cpu run queue, FIFO
+void rqInit(struct runqueue *rq);
+void rqPush(struct runqueue *rq, thread_t *t);
+thread_t *rqPop(struct runqueue *rq);
+
+// rqRemove: remove a ready thread from rq, with rq->lock
+// parameters: rq-run queue
+//             t-thread
+// outputs   : 1-removed, 0-not on rq
+int rqRemove(struct runqueue *rq, thread_t *t);
+
+// rqSteal: take up to n threads from tail of rq, highest
+//          priority first
+// parameters: rq-victim run queue
+//             thrs-out param, stolen threads
+//             n-max threads to take
+// outputs   : number of threads taken
+int rqSteal(struct runqueue *rq, thread_t **thrs, int n);
+
+// thrSteal: called by idle cpu c, steal from the cpu with the
+//           longest run queue, half of its queue (at most
+//           RQ_STEAL_MAX). the first one is returned to run,
+//           the rest go to c's run queue
+// parameters: c-idle cpu
+// outputs   : thread to run, NULL if nothing to steal
+thread_t *thrSteal(struct cpu *c);
+
+// thrCpuInit: set up scheduler, idle thread and run queue of c
+// parameters: c-cpu
+// outputs   : void
+void thrCpuInit(struct cpu *c);
+
+// thrSchedStart: leave boot stack and enter this cpu's
+//                scheduler, never return
+// parameters: void
+// outputs   : void
+void thrSchedStart();
+
+// thrIdle: idle thread, halt until next interrupt
+// parameters: arg-unused
+// outputs   : void
+void thrIdle(void *arg);
+
 // thrinit: initialize thread manager
 // parameters: void
 // outputs   : void
 void thrInit();
 
-// thrsched: schedule threads, round robin
+// thrsched: per-cpu scheduler, round robin on its run queue
 // parameters: void
 // outputs   : void
 void thrSched();
@@ -118,15 +203,24 @@ tid_t thrGettid();
 // outputs   : void
 void thrYeild();
 
-// thrJoin: wait thread(tid) to finish
+// thrJoin: wait thread(tid) to finish, and reap it. joiners
+//          sleep on the thread itself as condition variable,
+//          thrExit wakes them up
 // paramters: tid-thread's tid
-// outputs  : void
-void thrJoin(tid_t tid);
+// outputs  : exit code of thread(tid), -1 if it can't be joined,
+//            or another joiner reaped it, or it was detached
+int thrJoin(tid_t tid);
+
+// thrDetach: detach thread(tid), its slot is reaped as soon
+//            as it exits, nobody can join it any more
+// parameters: tid-thread's tid
+// outputs   : 0-success, -1-no such thread
+int thrDetach(tid_t tid);
 
 // thrExit: exit current thread
-// parameters: void
+// parameters: code-exit code for joiner
 // outputs   : void
-void thrExit();
+void thrExit(int code);
 
 // thrKill: kill thread(tid)
 // parameters: tid-thread's tid
@@ -149,11 +243,18 @@ void thrTest();
 //            spinlockUnlock(spl);
 void thrCondWait(void *cv, spinlock_t *spl);
 
-// thrCondSignal: notify one thread waiting on cv
+// thrCondSignal: notify one thread waiting on cv, not with
+//                thrque_lock held
 // paramters: cv-condition variable
 // outputs  : void
 void thrCondSignal(void *cv);
 
+// thrCondSignalPrio: notify the highest priority thread
+//                    waiting on cv
+// paramters: cv-condition variable
+// outputs  : void
+void thrCondSignalPrio(void *cv);
+
 // thrCondBroadcast: notify all thread waiting on cv
 // paramters: cv-condition variable
 // outputs  : void
@@ -165,11 +266,39 @@ void gfunc0(void *arg);
 void gfunc1(void *arg);
 void cvTest();
 
+void jfunc(void *arg);
+void joinThread(void *arg);
+void joinTest();
+
+// thrSetPrio: set base priority of a thread
+// parameters: tid-thread id
+//             prio-PRIO_LOW to PRIO_RT
+// outputs   : 0-success, -1-no such thread or bad priority
+int thrSetPrio(tid_t tid, int prio);
+
+// thrSetEffPrio: set effective priority, move the thread to
+//                the list of its new priority if it is queued
+// parameters: t-thread
+//             prio-effective priority
+// outputs   : void
+void thrSetEffPrio(thread_t *t, int prio);
+
 // mutex
+// adaptive mutex: an uncontended lock is a single cmpxchg on
+// lock, a contended locker spins while the owner is running on
+// a cpu (it will release soon), and only sleeps once the owner
+// is off cpu or the spin budget is spent. unlock wakes up just
+// one sleeper, the highest priority one, instead of broadcasting.
+// a sleeper lends its priority to the owner, and through the
+// mutex the owner sleeps on, until the owner unlocks
+#define MTX_SPIN_LIMIT 1000 // max spins before sleeping
+
 struct mutex
 {
-    uint32_t lock;
-    spinlock_t lk;
+    uint32_t lock;          // 0-free, 1-held
+    thread_t *owner;        // thread holding the mutex
+    int waiters;            // threads sleeping on this mutex
+    spinlock_t lk;          // protect waiters and sleep/wakeup
 };
 
 typedef struct mutex mutex_t;
@@ -184,6 +313,11 @@ void thrMutexInit(mutex_t *m);
 // outputs   : void
 void thrMutexLock(mutex_t *m);
 
+// thrMutexTryLock: try to lock a mutex without waiting
+// parameters: m-mutex
+// outputs   : 1-locked, 0-mutex is held by others
+int thrMutexTryLock(mutex_t *m);
+
 // thrMutexUnlock: unlock a mutex
 // parameters: m-mutex
 // outputs   : void
@@ -225,6 +359,64 @@ void producer(void *arg);
 void consumer(void *arg);
 void semTest();
 
-// TODO: read-write lock
+mutex_t pim; // priority inheritance test
+sem_t pisem;
+void piLow(void *arg);
+void piHigh(void *arg);
+void piTest();
+
+// read-write lock
+// sleeping reader-writer lock, for long read-mostly sections
+// which may block (e.g. path lookup reading disk). waiting
+// writers stop new readers (writer preference), so a steady
+// stream of readers can not starve a writer
+struct rwlock
+{
+    int readers;    // number of readers holding the lock
+    int writer;     // 1 if a writer holds the lock
+    int wwait;      // number of waiting writers
+    spinlock_t lk;  // protect fields above
+};
+
+typedef struct rwlock rwlock_t;
+
+// thrRwlockInit: initialize reader-writer lock
+// parameters: rw-reader-writer lock
+// outputs   : void
+void thrRwlockInit(rwlock_t *rw);
+
+// thrRwlockRdLock: lock for read, sleep while a writer
+//                  holds or waits for the lock
+// parameters: rw-reader-writer lock
+// outputs   : void
+void thrRwlockRdLock(rwlock_t *rw);
+
+// thrRwlockRdUnlock: unlock a read lock
+// parameters: rw-reader-writer lock
+// outputs   : void
+void thrRwlockRdUnlock(rwlock_t *rw);
+
+// thrRwlockWrLock: lock for write, sleep until no reader
+//                  or writer holds the lock
+// parameters: rw-reader-writer lock
+// outputs   : void
+void thrRwlockWrLock(rwlock_t *rw);
+
+// thrRwlockWrUnlock: unlock a write lock
+// parameters: rw-reader-writer lock
+// outputs   : void
+void thrRwlockWrUnlock(rwlock_t *rw);
+
+rwlock_t grw;
+rwspinlock_t grwsp;
+int rwspA, rwspB; // written as a pair under grwsp
+void rdfunc(void *arg);
+void wrfunc(void *arg);
+void rdspfunc(void *arg);
+void wrspfunc(void *arg);
+void rwThread(void *arg);
+// Test: reader-writer lock test, sleeping and spinning, runs in
+//       a thread of its own since it joins its threads
+void rwTest();
 
 #endif // _THREAD_H
\ No newline at end of file
@@ -1,11 +1,24 @@
 #include "timer.h"
 #include "port.h"
 #include "console.h"
+#include "workqueue.h"
+#include "thread.h"
+#include "apic.h"
 
 uint32_t ticks = 0;
 
 void timerDriverInit()
 {
+    cpuTicks = pcounterAlloc();
+    registerIrqHandler(IV_TIMER, timerInterruptHandler, NULL);
+
+    // local APIC timer when there is one, PIT stays masked
+    if(haveApic)
+    {
+        lapicTimerInit(SET_FREQ);
+        return ;
+    }
+
     uint32_t s = FREQUENCY / SET_FREQ;
 
     // set command byte
@@ -16,9 +29,17 @@ void timerDriverInit()
 
     outb(CHAN0_DATA_PORT, lowbit);
     outb(CHAN0_DATA_PORT, highbit);
+    irqEnable(IRQ_TIMER);
 }
 
-void timerInterruptHandler()
+void timerInterruptHandler(struct trapframe *tf, void *ctx)
 {
-    ticks++;
+    // every cpu has its own timer, only boot cpu keeps time
+    pcounterInc(cpuTicks);
+    if(mycpu()->id == 0)
+    {
+        ticks++;
+        wqTimerTick(&syswq);
+    }
+    needResched = 1;
 }
\ No newline at end of file
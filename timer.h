@@ -1,6 +1,10 @@
 #ifndef _TIMER_H
 #define _TIMER_H
 
+#include "types.h"
+#include "idt.h"
+#include "percpu.h"
+
 #define CHAN0_DATA_PORT 0x40
 #define CHAN1_DATA_PORT 0x41
 #define CHAN2_DATA_PORT 0x42
@@ -9,14 +13,20 @@
 #define FREQUENCY 1193180
 #define SET_FREQ  100
 
+// ticks since timer started, SET_FREQ ticks per second
+extern uint32_t ticks;
+// timer interrupts taken by each cpu, per-cpu counter
+pcounter_t cpuTicks;
+
 // timerDriverInit: initialize timer
 // parameters: void
 // outputs   : void
 void timerDriverInit();
 
 // timerInterruptHandler: handle timer interrupt
-// parameters: void
+// parameters: tf-trapframe
+//             ctx-unused
 // outpus    : void
-void timerInterruptHandler();
+void timerInterruptHandler(struct trapframe *tf, void *ctx);
 
 #endif // _TIMER_H
\ No newline at end of file
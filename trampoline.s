@@ -0,0 +1,53 @@
+# application processor startup code, copied to 0x7000 by smpInit.
+# an AP starts here in real mode at 0x0700:0000 after SIPI, gets
+# into protected mode with a flat gdt, then jumps to the C entry
+# the BSP left at 0x7000-8, on the stack at 0x7000-4, with the
+# struct cpu * at 0x7000-12 as argument
+
+.set TRAMP, 0x7000
+
+.code16
+.globl trampStart
+trampStart:
+  cli
+  xorw %ax, %ax
+  movw %ax, %ds
+  movw %ax, %es
+  movw %ax, %ss
+
+  lgdtl (trampGdtDesc - trampStart + TRAMP)
+  movl %cr0, %eax
+  orl $0x1, %eax
+  movl %eax, %cr0
+
+  ljmpl $0x8, $(trampStart32 - trampStart + TRAMP)
+
+.code32
+trampStart32:
+  movw $0x10, %ax
+  movw %ax, %ds
+  movw %ax, %es
+  movw %ax, %ss
+  xorw %ax, %ax
+  movw %ax, %fs
+  movw %ax, %gs
+
+  movl (TRAMP - 4), %esp
+  pushl (TRAMP - 12)
+  call *(TRAMP - 8)
+
+trampSpin:
+  hlt
+  jmp trampSpin
+
+.p2align 3
+trampGdt:
+  .quad 0x0000000000000000 # null
+  .quad 0x00cf9a000000ffff # kernel code, flat
+  .quad 0x00cf92000000ffff # kernel data, flat
+trampGdtDesc:
+  .word (trampGdtDesc - trampGdt - 1)
+  .long (trampGdt - trampStart + TRAMP)
+
+.globl trampEnd
+trampEnd:
@@ -18,6 +18,8 @@ typedef unsigned int size_t;
 
 typedef unsigned int tid_t;
 
+typedef uint64_t sector_t; // disk address, in sectors or blocks
+
 #define false 0
 #define true  1
 
@@ -0,0 +1,358 @@
+#include "virtio.h"
+#include "pci.h"
+#include "port.h"
+#include "console.h"
+#include "softirq.h"
+#include "thread.h"
+
+// vioMb: full barrier, a store before it is visible before a
+//        load after it
+void vioMb()
+{
+    asm volatile("lock; addl $0, 0(%%esp)" : : : "memory");
+}
+
+int vioInit()
+{
+    nvioDev = 0;
+    ringInit(&vioDone, vioDoneSlots, VIO_NDONE, RING_SC_DEQ);
+
+    for(int n = 0; nvioDev < VIO_NDEV; n++)
+    {
+        struct pciDev *d = pciFindId(VIO_VENDOR, VIO_DEV_BLK, n);
+        if(d == NULL)
+        {
+            break;
+        }
+        if(!(d->bar[0] & PCI_BAR_IO))
+        {
+            continue;
+        }
+
+        pciEnable(d);
+        struct vioDev *vd = &(vioDevs[nvioDev]);
+        vd->device = VIO_DEV_BASE + nvioDev;
+        vd->iobase = d->bar[0] & ~0x3;
+        vd->irq = d->irq;
+        if(vioDevInit(vd) == 0)
+        {
+            nvioDev++;
+        }
+    }
+    return nvioDev;
+}
+
+int vioDevInit(struct vioDev *vd)
+{
+    uint16_t io = vd->iobase;
+
+    // 1. reset, then tell the device it is found and driven
+    outb(io + VIO_STATUS, 0);
+    outb(io + VIO_STATUS, VIO_ST_ACK);
+    outb(io + VIO_STATUS, VIO_ST_ACK | VIO_ST_DRIVER);
+
+    // 2. take the features we know
+    vd->features = inl(io + VIO_HOST_FEATURES) & (VIO_F_INDIRECT_DESC | VIO_F_EVENT_IDX | VIO_F_BLK_FLUSH);
+    outl(io + VIO_GUEST_FEATURES, vd->features);
+
+    // 3. queue 0, legacy layout: descriptors and avail ring,
+    //    used ring on next page
+    outw(io + VIO_QUEUE_SEL, 0);
+    vd->qsize = inw(io + VIO_QUEUE_SIZE);
+    if(vd->qsize == 0 || vd->qsize > VIO_QMAX || vd->irq >= 16)
+    {
+        printf("[virtio] device at %x not usable\n", io);
+        outb(io + VIO_STATUS, VIO_ST_FAILED);
+        return -1;
+    }
+    memset(vd->ringMem, 0, VIO_RING_BYTES);
+    vd->desc = (struct vringDesc *)vd->ringMem;
+    vd->avail = (struct vringAvail *)(vd->ringMem + 16 * vd->qsize);
+    vd->used = (struct vringUsed *)(vd->ringMem + PGUPBOUND(16 * vd->qsize + 6 + 2 * vd->qsize));
+    vd->availIdx = 0;
+    vd->lastUsed = 0;
+    vd->issued = 0;
+    outl(io + VIO_QUEUE_PFN, (uint32_t)vd->ringMem / PGSIZE);
+
+    // 4. capacity in 512 bytes sectors
+    vd->nsect = (sector_t)inl(io + VIO_CONFIG) | ((sector_t)inl(io + VIO_CONFIG + 4) << 32);
+
+    // 5. with indirect descriptors a request takes one queue
+    //    slot, else the whole queue
+    int depth = 1;
+    int maxBlk = vd->qsize - 2;
+    if(vd->features & VIO_F_INDIRECT_DESC)
+    {
+        depth = (vd->qsize < VIO_NREQ) ? vd->qsize : VIO_NREQ;
+        maxBlk = VIO_MAX_BLK;
+    }
+    else if(maxBlk > VIO_MAX_BLK)
+    {
+        maxBlk = VIO_MAX_BLK;
+    }
+    blkQueueInit(&(vd->q), maxBlk, depth, vioStart);
+
+    bhRegister(MASTER_BOUND + vd->irq, vioBottomHalf);
+    registerIrqHandler(MASTER_BOUND + vd->irq, vioInterruptHandler, vd);
+    irqEnable(vd->irq);
+
+    outb(io + VIO_STATUS, VIO_ST_ACK | VIO_ST_DRIVER | VIO_ST_DRIVER_OK);
+    blkDevRegister(vd->device, "vd", &vioOps, &(vd->q), vd);
+    printf("[virtio] disk %d: %d MB, queue %d, depth %d\n", vd->device,
+           (int)(vd->nsect >> 11), vd->qsize, depth);
+    return 0;
+}
+
+// vioNeedKick: device wants a notify for avail idx moving
+//              from old to vd->availIdx
+int vioNeedKick(struct vioDev *vd, uint16_t old)
+{
+    if(vd->features & VIO_F_EVENT_IDX)
+    {
+        uint16_t ev = VRING_AVAIL_EVENT(vd);
+        return (uint16_t)(vd->availIdx - ev - 1) < (uint16_t)(vd->availIdx - old);
+    }
+    return !(vd->used->flags & VRING_USED_F_NO_NOTIFY);
+}
+
+// vioIntr: turn interrupts from the used ring on or off
+void vioIntr(struct vioDev *vd, int on)
+{
+    if(vd->features & VIO_F_EVENT_IDX)
+    {
+        // off needs nothing, the device passed usedEvent
+        if(on)
+        {
+            VRING_USED_EVENT(vd) = vd->lastUsed;
+        }
+    }
+    else
+    {
+        vd->avail->flags = on ? 0 : VRING_AVAIL_F_NO_INTERRUPT;
+    }
+}
+
+void vioDesc(struct vringDesc *d, void *addr, uint32_t len, uint16_t flags)
+{
+    d->addr = (uint32_t)addr;
+    d->len = len;
+    d->flags = flags;
+    d->next = 0;
+}
+
+void vioStart(struct reqQueue *q, struct request *rq)
+{
+    // q is the first member of its device
+    struct vioDev *vd = (struct vioDev *)q;
+    int indirect = (vd->features & VIO_F_INDIRECT_DESC) != 0;
+
+    int slot = 0;
+    while(vd->issued & ((uint32_t)1 << slot))
+    {
+        slot++;
+    }
+
+    // 1. header, block buffers, status. in the indirect table
+    //    of the slot, or in the queue itself
+    struct vioBlkHdr *h = &(vd->hdr[slot]);
+    h->type = rq->write ? VIO_BLK_T_OUT : VIO_BLK_T_IN;
+    h->rsv = 0;
+    h->sector = rq->block * SEC_PER_BLK;
+    vd->status[slot] = 0xff;
+
+    struct vringDesc *d = indirect ? vd->ind[slot] : vd->desc;
+    int n = 0;
+    vioDesc(&(d[n++]), h, sizeof(*h), 0);
+    for(struct block *b = rq->head; b != NULL; b = b->io_next)
+    {
+        vioDesc(&(d[n++]), b->buf, BSIZE, rq->write ? 0 : VRING_DESC_F_WRITE);
+    }
+    vioDesc(&(d[n++]), &(vd->status[slot]), 1, VRING_DESC_F_WRITE);
+    for(int i = 0; i < n - 1; i++)
+    {
+        d[i].flags |= VRING_DESC_F_NEXT;
+        d[i].next = i + 1;
+    }
+
+    int head = 0;
+    if(indirect)
+    {
+        head = slot;
+        vioDesc(&(vd->desc[slot]), d, n * sizeof(struct vringDesc), VRING_DESC_F_INDIRECT);
+    }
+
+    // 2. publish head, descriptors before idx
+    vd->slotRq[slot] = rq;
+    vd->issued |= ((uint32_t)1 << slot);
+    vd->avail->ring[vd->availIdx & (vd->qsize - 1)] = head;
+    asm volatile("" : : : "memory");
+    uint16_t old = vd->availIdx++;
+    vd->avail->idx = vd->availIdx;
+
+    // 3. notify, unless the device is still working through
+    //    the ring and said so
+    vioMb();
+    if(vioNeedKick(vd, old))
+    {
+        outw(vd->iobase + VIO_QUEUE_NOTIFY, 0);
+    }
+}
+
+void vioInterruptHandler(struct trapframe *tf, void *ctx)
+{
+    struct vioDev *vd = ctx;
+
+    // read acks, bit 0 is the queue. shared line otherwise
+    if(!(inb(vd->iobase + VIO_ISR) & 1))
+    {
+        return ;
+    }
+
+    int more = 1;
+    while(more)
+    {
+        struct request *fin[VIO_NREQ];
+        int nfin = 0;
+        uint32_t eflags = spinlockLockSave(&(vd->q.lock));
+
+        // 1. no interrupts while draining the used ring
+        vioIntr(vd, 0);
+        while(nfin < VIO_NREQ && vd->lastUsed != vd->used->idx)
+        {
+            asm volatile("" : : : "memory");
+            struct vringUsedElem *e = &(vd->used->ring[vd->lastUsed & (vd->qsize - 1)]);
+            int slot = (vd->features & VIO_F_INDIRECT_DESC) ? e->id : 0;
+            struct request *rq = vd->slotRq[slot];
+            vd->slotRq[slot] = NULL;
+            vd->issued &= ~((uint32_t)1 << slot);
+            vd->lastUsed++;
+            fin[nfin++] = blkComplete(&(vd->q), rq, vd->status[slot] != 0);
+        }
+
+        // 2. ask again, an entry which came meanwhile is
+        //    taken now
+        vioIntr(vd, 1);
+        vioMb();
+        more = (vd->lastUsed != vd->used->idx);
+        spinlockUnlockRestore(&(vd->q.lock), eflags);
+
+        // 3. wake up threads in bottom half
+        for(int k = 0; k < nfin; k++)
+        {
+            if(ringEnqueue(&vioDone, fin[k]) != 0)
+            {
+                blkWakeup(&(vd->q), fin[k]);
+            }
+        }
+        if(nfin > 0)
+        {
+            bhRaise(MASTER_BOUND + vd->irq);
+        }
+    }
+}
+
+void vioBottomHalf()
+{
+    void *done[8];
+    int n;
+    while((n = ringDequeueBurst(&vioDone, done, 8)) > 0)
+    {
+        for(int i = 0; i < n; i++)
+        {
+            struct request *rq = done[i];
+            blkWakeup(vioQueue(rq->device), rq);
+        }
+    }
+}
+
+int vioRw(struct blkDev *bd, struct block **blks, int n, int write, sector_t start)
+{
+    struct vioDev *vd = bd->priv;
+    return blkRwAt(&(vd->q), blks, n, write, vd->device, start);
+}
+
+int vioFlush(struct blkDev *bd)
+{
+    struct vioDev *vd = bd->priv;
+    if(!(vd->features & VIO_F_BLK_FLUSH))
+    {
+        return 0;
+    }
+    blkDrain(&(vd->q));
+
+    // 1. header and status in slot 0 and its descriptors, free
+    //    with the queue drained
+    uint32_t eflags = spinlockLockSave(&(vd->q.lock));
+    struct vioBlkHdr *h = &(vd->hdr[0]);
+    h->type = VIO_BLK_T_FLUSH;
+    h->rsv = 0;
+    h->sector = 0;
+    vd->status[0] = 0xff;
+    vioDesc(&(vd->desc[0]), h, sizeof(*h), VRING_DESC_F_NEXT);
+    vd->desc[0].next = 1;
+    vioDesc(&(vd->desc[1]), &(vd->status[0]), 1, VRING_DESC_F_WRITE);
+
+    // 2. publish and always notify, the interrupt handler
+    //    can't run here and the entry is taken by polling
+    vd->avail->ring[vd->availIdx & (vd->qsize - 1)] = 0;
+    asm volatile("" : : : "memory");
+    vd->availIdx++;
+    vd->avail->idx = vd->availIdx;
+    vioMb();
+    outw(vd->iobase + VIO_QUEUE_NOTIFY, 0);
+    while(vd->lastUsed == vd->used->idx)
+    {
+        cpuRelax();
+    }
+    vd->lastUsed++;
+    inb(vd->iobase + VIO_ISR);
+
+    // 3. used event follows the entry taken here, else the
+    //    device thinks the next completion needs no interrupt
+    vioIntr(vd, 1);
+    vioMb();
+    int err = (vd->status[0] != 0);
+    spinlockUnlockRestore(&(vd->q.lock), eflags);
+
+    blkUndrain(&(vd->q));
+    return err ? -1 : 0;
+}
+
+sector_t vioSize(struct blkDev *bd)
+{
+    return ((struct vioDev *)bd->priv)->nsect / SEC_PER_BLK;
+}
+
+struct blkOps vioOps = {vioRw, NULL, vioFlush, vioSize};
+
+struct reqQueue *vioQueue(int device)
+{
+    int i = device - VIO_DEV_BASE;
+    if(i < 0 || i >= nvioDev)
+    {
+        return NULL;
+    }
+    return &(vioDevs[i].q);
+}
+
+int vioRead(struct block *blk)
+{
+    struct reqQueue *q = vioQueue(blk->device);
+    if(q == NULL)
+    {
+        return -1;
+    }
+    blkSubmit(q, blk, 0);
+    return blkWait(q, blk);
+}
+
+int vioWrite(struct block *blk)
+{
+    struct reqQueue *q = vioQueue(blk->device);
+    if(q == NULL)
+    {
+        return -1;
+    }
+    blkSubmit(q, blk, 1);
+    return blkWait(q, blk);
+}
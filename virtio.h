@@ -0,0 +1,207 @@
+#ifndef _VIRTIO_H
+#define _VIRTIO_H
+
+#include "types.h"
+#include "memory.h"
+#include "ide.h"
+#include "blk.h"
+#include "ahci.h"
+#include "ring.h"
+
+// virtio-blk, legacy PCI interface
+// registers are in the I/O BAR0. the device has one split
+// virtqueue: a descriptor table, an avail ring the driver puts
+// request heads on and a used ring the device returns them on.
+// a request is a header, the block buffers and a status byte,
+// with indirect descriptors it takes one slot of the queue.
+// notifications both ways are suppressed by event index when
+// the device has it, else by the ring flags
+
+#define VIO_VENDOR  0x1af4
+#define VIO_DEV_BLK 0x1001 // legacy (transitional) block device
+
+// legacy registers
+#define VIO_HOST_FEATURES  0x00
+#define VIO_GUEST_FEATURES 0x04
+#define VIO_QUEUE_PFN      0x08 // queue address / 4096
+#define VIO_QUEUE_SIZE     0x0c
+#define VIO_QUEUE_SEL      0x0e
+#define VIO_QUEUE_NOTIFY   0x10
+#define VIO_STATUS         0x12
+#define VIO_ISR            0x13 // read acks the interrupt
+#define VIO_CONFIG         0x14 // device config, without MSI-X
+
+#define VIO_ST_ACK       0x01
+#define VIO_ST_DRIVER    0x02
+#define VIO_ST_DRIVER_OK 0x04
+#define VIO_ST_FAILED    0x80
+
+#define VIO_F_BLK_RO        (1 << 5)
+#define VIO_F_BLK_FLUSH     (1 << 9) // has VIO_BLK_T_FLUSH
+#define VIO_F_INDIRECT_DESC (1 << 28)
+#define VIO_F_EVENT_IDX     (1 << 29)
+
+// split virtqueue
+struct vringDesc
+{
+    uint64_t addr;
+    uint32_t len;
+    uint16_t flags; // VRING_DESC_F_*
+    uint16_t next;
+}__attribute__((packed));
+
+#define VRING_DESC_F_NEXT     1
+#define VRING_DESC_F_WRITE    2 // device writes
+#define VRING_DESC_F_INDIRECT 4 // addr is a table of descriptors
+
+struct vringAvail
+{
+    volatile uint16_t flags; // VRING_AVAIL_F_NO_INTERRUPT
+    volatile uint16_t idx;
+    volatile uint16_t ring[]; // then used_event
+};
+
+#define VRING_AVAIL_F_NO_INTERRUPT 1
+
+struct vringUsedElem
+{
+    uint32_t id;  // head descriptor
+    uint32_t len;
+};
+
+struct vringUsed
+{
+    volatile uint16_t flags; // VRING_USED_F_NO_NOTIFY
+    volatile uint16_t idx;
+    struct vringUsedElem ring[]; // then avail_event
+};
+
+#define VRING_USED_F_NO_NOTIFY 1
+
+// event index, after the avail and used rings. the device
+// interrupts once used idx passes usedEvent, the driver
+// notifies once avail idx passes availEvent
+#define VRING_USED_EVENT(vd)  ((vd)->avail->ring[(vd)->qsize])
+#define VRING_AVAIL_EVENT(vd) (*(volatile uint16_t *)&((vd)->used->ring[(vd)->qsize]))
+
+#define VIO_QMAX 256 // largest queue taken
+#define VIO_RING_BYTES (PGUPBOUND(16 * VIO_QMAX + 6 + 2 * VIO_QMAX) + \
+                        PGUPBOUND(6 + 8 * VIO_QMAX))
+
+// request header and status
+#define VIO_BLK_T_IN  0
+#define VIO_BLK_T_OUT 1
+#define VIO_BLK_T_FLUSH 4
+
+struct vioBlkHdr
+{
+    uint32_t type;
+    uint32_t rsv;
+    uint64_t sector;
+}__attribute__((packed));
+
+#define VIO_NREQ    32  // requests on the device at once
+#define VIO_NIND    128 // descriptors in an indirect table
+#define VIO_MAX_BLK (VIO_NIND - 2)
+#define VIO_NDEV    2
+#define VIO_DEV_BASE (AHCI_DEV_BASE + AHCI_NPORT)
+
+struct vioDev
+{
+    struct reqQueue q;          // first, start() casts it back
+    int device;                 // device number
+    uint16_t iobase;            // BAR0
+    int irq;
+    uint32_t features;          // negotiated
+    uint16_t qsize;             // descriptors in queue
+    uint16_t availIdx;          // next avail slot, free running
+    uint16_t lastUsed;          // used entries seen
+    struct vringDesc *desc;
+    struct vringAvail *avail;
+    struct vringUsed *used;
+    uint32_t issued;            // slots in use
+    struct request *slotRq[VIO_NREQ];
+    struct vioBlkHdr hdr[VIO_NREQ];
+    uint8_t status[VIO_NREQ];
+    struct vringDesc ind[VIO_NREQ][VIO_NIND] __attribute__((aligned(16)));
+    sector_t nsect;             // capacity in sectors
+    char ringMem[VIO_RING_BYTES] __attribute__((aligned(4096)));
+};
+
+struct vioDev vioDevs[VIO_NDEV];
+int nvioDev;
+
+// finished requests, from interrupt handler to bottom half
+#define VIO_NDONE 64
+struct ring vioDone;
+void *vioDoneSlots[VIO_NDONE];
+
+// vioInit: find virtio-blk devices on PCI, negotiate features,
+//          set up their queue and request queue
+// parameters: void
+// outputs   : number of devices
+int vioInit();
+
+// vioDevInit: bring up one virtio-blk device
+// parameters: vd-device, iobase and irq filled
+// outputs   : success or not
+int vioDevInit(struct vioDev *vd);
+
+// vioStart: put rq on the avail ring and notify the device
+//           unless it asked not to, start function of the queue
+// parameters: q-queue of the device
+//             rq-request
+// outputs   : void
+void vioStart(struct reqQueue *q, struct request *rq);
+
+// vioInterruptHandler: ack interrupt and finish requests on the
+//                      used ring
+// parameters: tf-trapframe
+//             ctx-device
+// outputs   : void
+void vioInterruptHandler(struct trapframe *tf, void *ctx);
+
+// vioBottomHalf: wake up threads whose requests are finished
+// parameters: void
+// outputs   : void
+void vioBottomHalf();
+
+struct blkOps vioOps; // vioRw, vioFlush, vioSize, no bio
+
+// vioRw: rw operation of virtio disks, on the device queue
+// parameters: bd-disk, priv is the device
+//             blks-blocks
+//             n-number of blocks
+//             write-1 write, 0 read
+//             start-offset on the disk
+// outputs   : success or not
+int vioRw(struct blkDev *bd, struct block **blks, int n, int write, sector_t start);
+
+// vioFlush: flush operation of virtio disks, a flush request
+//           with the queue drained, polled. nothing to do if
+//           the device has no flush, its writes are durable
+// parameters: bd-disk, priv is the device
+// outputs   : success or not
+int vioFlush(struct blkDev *bd);
+
+// vioSize: size operation of virtio disks
+// parameters: bd-disk, priv is the device
+// outputs   : blocks on disk
+sector_t vioSize(struct blkDev *bd);
+
+// vioQueue: request queue of a device
+// parameters: device-device number
+// outputs   : queue, NULL if the device is not virtio-blk
+struct reqQueue *vioQueue(int device);
+
+// vioRead: read a block from virtio disk blk->device
+// parameters: blk-read into this block
+// outputs   : success or not
+int vioRead(struct block *blk);
+
+// vioWrite: write a block to virtio disk blk->device
+// parameters: blk-write this block to disk
+// outputs   : success or not
+int vioWrite(struct block *blk);
+
+#endif // _VIRTIO_H
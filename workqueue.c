@@ -0,0 +1,273 @@
+#include "workqueue.h"
+#include "timer.h"
+#include "console.h"
+
+// wqAlloc: take a free work item, wq->lock held
+struct work *wqAlloc(struct workqueue *wq)
+{
+    struct work *wk = wq->freeList;
+    if(wk != NULL)
+    {
+        wq->freeList = wk->next;
+        wk->next = NULL;
+    }
+    return wk;
+}
+
+// wqFree: put work item back to free list, wq->lock held
+void wqFree(struct workqueue *wq, struct work *wk)
+{
+    wk->state = WORK_FREE;
+    wk->next = wq->freeList;
+    wq->freeList = wk;
+}
+
+// wqPend: add work to the tail of pending list and wake
+//         up a worker, wq->lock held
+void wqPend(struct workqueue *wq, struct work *wk)
+{
+    wk->state = WORK_PENDING;
+    wk->next = NULL;
+    if(wq->tail == NULL)
+    {
+        wq->head = wk;
+    }
+    else
+    {
+        wq->tail->next = wk;
+    }
+    wq->tail = wk;
+    thrCondSignal(&(wq->head));
+}
+
+void wqInit(struct workqueue *wq)
+{
+    spinlockInit(&(wq->lock));
+    wq->freeList = NULL;
+    for(int i = WQ_NWORK - 1; i >= 0; i--)
+    {
+        wqFree(wq, &(wq->works[i]));
+    }
+    wq->head = NULL;
+    wq->tail = NULL;
+    wq->delayed = NULL;
+    wq->nrunning = 0;
+
+    for(int i = 0; i < WQ_NWORKER; i++)
+    {
+        wq->workers[i] = thrCreate(wqWorker, wq);
+        thrDetach(wq->workers[i]);
+    }
+}
+
+void wqWorker(void *arg)
+{
+    struct workqueue *wq = (struct workqueue *)arg;
+    struct work *wk;
+    void (*func)(void *);
+    void *farg;
+
+    for(;;)
+    {
+        spinlockLock(&(wq->lock));
+        while(wq->head == NULL)
+        {
+            thrCondWait(&(wq->head), &(wq->lock));
+        }
+
+        // 1. take the head of pending list
+        wk = wq->head;
+        wq->head = wk->next;
+        if(wq->head == NULL)
+        {
+            wq->tail = NULL;
+        }
+        wk->state = WORK_RUNNING;
+        wq->nrunning++;
+        func = wk->func;
+        farg = wk->arg;
+        spinlockUnlock(&(wq->lock));
+
+        // 2. run it without the lock
+        func(farg);
+
+        // 3. recycle the item, wake up flushers when idle
+        spinlockLock(&(wq->lock));
+        wq->nrunning--;
+        wqFree(wq, wk);
+        if(wq->head == NULL && wq->nrunning == 0)
+        {
+            thrCondBroadcast(&(wq->nrunning));
+        }
+        spinlockUnlock(&(wq->lock));
+    }
+}
+
+struct work *wqQueueWork(struct workqueue *wq, void (*func)(void *), void *arg)
+{
+    spinlockLock(&(wq->lock));
+    struct work *wk = wqAlloc(wq);
+    if(wk == NULL)
+    {
+        spinlockUnlock(&(wq->lock));
+        printf("[Error] wqQueueWork: no free work\n");
+        return NULL;
+    }
+    wk->func = func;
+    wk->arg = arg;
+    wqPend(wq, wk);
+    spinlockUnlock(&(wq->lock));
+
+    return wk;
+}
+
+struct work *wqQueueDelayedWork(struct workqueue *wq, void (*func)(void *),
+                                void *arg, uint32_t delay)
+{
+    if(delay == 0)
+    {
+        return wqQueueWork(wq, func, arg);
+    }
+
+    spinlockLock(&(wq->lock));
+    struct work *wk = wqAlloc(wq);
+    if(wk == NULL)
+    {
+        spinlockUnlock(&(wq->lock));
+        printf("[Error] wqQueueDelayedWork: no free work\n");
+        return NULL;
+    }
+    wk->func = func;
+    wk->arg = arg;
+    wk->expires = ticks + delay;
+    wk->state = WORK_DELAYED;
+    wk->next = wq->delayed;
+    wq->delayed = wk;
+    spinlockUnlock(&(wq->lock));
+
+    return wk;
+}
+
+int wqCancelWork(struct workqueue *wq, struct work *wk)
+{
+    struct work **pp;
+    int cancelled = 0;
+
+    spinlockLock(&(wq->lock));
+    if(wk->state == WORK_PENDING)
+    {
+        struct work *prev = NULL;
+        for(pp = &(wq->head); *pp != NULL; pp = &((*pp)->next))
+        {
+            if(*pp == wk)
+            {
+                *pp = wk->next;
+                if(wq->tail == wk)
+                {
+                    wq->tail = prev;
+                }
+                cancelled = 1;
+                break;
+            }
+            prev = *pp;
+        }
+    }
+    else if(wk->state == WORK_DELAYED)
+    {
+        for(pp = &(wq->delayed); *pp != NULL; pp = &((*pp)->next))
+        {
+            if(*pp == wk)
+            {
+                *pp = wk->next;
+                cancelled = 1;
+                break;
+            }
+        }
+    }
+
+    if(cancelled)
+    {
+        wqFree(wq, wk);
+        if(wq->head == NULL && wq->nrunning == 0)
+        {
+            thrCondBroadcast(&(wq->nrunning));
+        }
+    }
+    spinlockUnlock(&(wq->lock));
+
+    return cancelled;
+}
+
+void wqFlush(struct workqueue *wq)
+{
+    spinlockLock(&(wq->lock));
+    while(wq->head != NULL || wq->nrunning > 0)
+    {
+        thrCondWait(&(wq->nrunning), &(wq->lock));
+    }
+    spinlockUnlock(&(wq->lock));
+}
+
+void wqTimerTick(struct workqueue *wq)
+{
+    uint32_t eflags = spinlockLockSave(&(wq->lock));
+    struct work **pp = &(wq->delayed);
+    while(*pp != NULL)
+    {
+        struct work *wk = *pp;
+        if((int)(ticks - wk->expires) >= 0)
+        {
+            *pp = wk->next;
+            wqPend(wq, wk);
+        }
+        else
+        {
+            pp = &(wk->next);
+        }
+    }
+    spinlockUnlockRestore(&(wq->lock), eflags);
+}
+
+struct work *queueWork(void (*func)(void *), void *arg)
+{
+    return wqQueueWork(&syswq, func, arg);
+}
+
+struct work *queueDelayedWork(void (*func)(void *), void *arg, uint32_t delay)
+{
+    return wqQueueDelayedWork(&syswq, func, arg, delay);
+}
+
+int cancelWork(struct work *wk)
+{
+    return wqCancelWork(&syswq, wk);
+}
+
+void flushWork()
+{
+    wqFlush(&syswq);
+}
+
+void wfunc(void *arg)
+{
+    printf("work: %s\n", (char *)arg);
+}
+
+// wqTestThread: body of wqTest, flushWork sleeps so it needs a
+// thread of its own
+void wqTestThread(void *arg)
+{
+    queueWork(wfunc, "A");
+    queueWork(wfunc, "B");
+    queueDelayedWork(wfunc, "delayed 1s", SET_FREQ);
+    struct work *wk = queueDelayedWork(wfunc, "cancelled", SET_FREQ);
+    printf("cancel: %d\n", cancelWork(wk));
+    flushWork();
+    printf("work A, B flushed\n");
+}
+
+void wqTest()
+{
+    // called from kernelMain before threads are scheduled
+    thrDetach(thrCreate(wqTestThread, NULL));
+}
@@ -0,0 +1,99 @@
+#ifndef _WORKQUEUE_H
+#define _WORKQUEUE_H
+
+#include "types.h"
+#include "concurrency.h"
+#include "thread.h"
+
+// work queue: deferred work runs in a pool of kernel worker
+// threads, off the interrupt handler or the caller's path
+
+#define WQ_NWORKER 4  // worker threads per work queue
+#define WQ_NWORK  64  // work items per work queue
+
+#define WORK_FREE    0 // on free list
+#define WORK_PENDING 1 // waiting for a worker
+#define WORK_DELAYED 2 // waiting for its timer
+#define WORK_RUNNING 3 // a worker is running it
+
+struct work
+{
+    void (*func)(void *); // function to run
+    void *arg;            // argument of func
+    int state;            // WORK_FREE, WORK_PENDING ...
+    uint32_t expires;     // tick to queue at, for delayed work
+    struct work *next;
+};
+
+struct workqueue
+{
+    struct work works[WQ_NWORK];
+    struct work *freeList;  // unused work items
+    struct work *head;      // pending list, FIFO
+    struct work *tail;
+    struct work *delayed;   // delayed work, not in order
+    int nrunning;           // works being run by workers
+    tid_t workers[WQ_NWORKER];
+    spinlock_t lock;
+};
+
+// system work queue, for queueWork and friends
+struct workqueue syswq;
+
+// wqInit: initialize a work queue and start its workers
+// parameters: wq-work queue
+// outputs   : void
+void wqInit(struct workqueue *wq);
+
+// wqWorker: worker thread, run pending works forever
+// parameters: arg-work queue
+// outputs   : void
+void wqWorker(void *arg);
+
+// wqQueueWork: queue func(arg) to run on a worker of wq
+// parameters: wq-work queue
+//             func-function to run
+//             arg-argument of func
+// outputs   : work handle (valid until it runs), NULL if
+//             no free work item
+struct work *wqQueueWork(struct workqueue *wq, void (*func)(void *), void *arg);
+
+// wqQueueDelayedWork: queue func(arg) after delay ticks
+// parameters: wq-work queue
+//             func-function to run
+//             arg-argument of func
+//             delay-ticks to wait (SET_FREQ ticks per second)
+// outputs   : work handle, NULL if no free work item
+struct work *wqQueueDelayedWork(struct workqueue *wq, void (*func)(void *),
+                                void *arg, uint32_t delay);
+
+// wqCancelWork: cancel a pending or delayed work
+// parameters: wq-work queue
+//             wk-work handle
+// outputs   : 1-cancelled, 0-already running or finished
+int wqCancelWork(struct workqueue *wq, struct work *wk);
+
+// wqFlush: wait until all pending works of wq have run,
+//          delayed works which are not due are not waited
+// parameters: wq-work queue
+// outputs   : void
+void wqFlush(struct workqueue *wq);
+
+// wqTimerTick: move due delayed works to pending list,
+//              called from timer interrupt
+// parameters: wq-work queue
+// outputs   : void
+void wqTimerTick(struct workqueue *wq);
+
+// queueWork, queueDelayedWork, cancelWork, flushWork:
+// same as above, on the system work queue
+struct work *queueWork(void (*func)(void *), void *arg);
+struct work *queueDelayedWork(void (*func)(void *), void *arg, uint32_t delay);
+int cancelWork(struct work *wk);
+void flushWork();
+
+// Test: work queue test, runs in a thread of its own since
+//       flushWork sleeps
+void wqTest();
+
+#endif // _WORKQUEUE_H